@@ -0,0 +1,141 @@
+#!/bin/sh
+#
+# End to end load test of the mod_wl verification path.
+#
+# Starts bench/wl_fakedns on loopback and a private httpd with
+# mod_remoteip and mod_wl, then drives it with bench/wl_load in
+# three phases:
+#
+#   cold      every request comes from a new address, so each
+#             one pays for a reverse and a forward lookup
+#   warm      the same addresses again, answered from the
+#             shared verdicts
+#   brownout  new addresses while DNS is slow and drops and
+#             mismatches some answers
+#
+# Results are written to bench/e2e_results.json (or $OUT).
+#
+# Settings, from the environment:
+#   APXS, HTTPD          apxs and httpd binaries
+#   PORT, DNSPORT        listen ports (8089, 5300)
+#   REQUESTS, CONNS      requests and connections per phase
+#   BROWN_REQUESTS       requests in the brownout phase (2000)
+#   LATENCY, JITTER      healthy DNS latency in ms (2, 1)
+#   BROWN_LATENCY, BROWN_JITTER, BROWN_DROP, BROWN_MISMATCH
+#                        brownout DNS (300, 200, 0.2, 0.05)
+#   DNS_TIMEOUT          WLDnsTimeout in ms (1000)
+
+set -e
+
+cd "$(dirname "$0")/.."
+TOP=$(pwd)
+
+APXS=${APXS:-apxs}
+HTTPD=${HTTPD:-$($APXS -q SBINDIR)/$($APXS -q PROGNAME)}
+PORT=${PORT:-8089}
+DNSPORT=${DNSPORT:-5300}
+REQUESTS=${REQUESTS:-20000}
+CONNS=${CONNS:-32}
+BROWN_REQUESTS=${BROWN_REQUESTS:-2000}
+LATENCY=${LATENCY:-2}
+JITTER=${JITTER:-1}
+BROWN_LATENCY=${BROWN_LATENCY:-300}
+BROWN_JITTER=${BROWN_JITTER:-200}
+BROWN_DROP=${BROWN_DROP:-0.2}
+BROWN_MISMATCH=${BROWN_MISMATCH:-0.05}
+DNS_TIMEOUT=${DNS_TIMEOUT:-1000}
+OUT=${OUT:-$TOP/bench/e2e_results.json}
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/wl_e2e.XXXXXX")
+DNSPID=
+
+cleanup() {
+    [ -f "$WORK/httpd.pid" ] && "$HTTPD" -f "$WORK/httpd.conf" -k stop 2>/dev/null || true
+    [ -n "$DNSPID" ] && kill "$DNSPID" 2>/dev/null || true
+    sleep 1
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+make -s bench/wl_fakedns bench/wl_load
+
+# the module, built into the work directory
+cp mod_wl.c wl_match.c wl_match.h "$WORK/"
+(cd "$WORK" && "$APXS" -c mod_wl.c wl_match.c >/dev/null)
+
+# 2 * REQUESTS googlebot-like hosts in 10.0.0.0/8, the first
+# half for the cold and warm phases, the second for brownout
+awk -v n=$((REQUESTS * 2)) 'BEGIN {
+    for (i = 1; i <= n; i++) {
+        a = int(i / 65536) % 256; b = int(i / 256) % 256; c = i % 256
+        printf "10.%d.%d.%d crawl-10-%d-%d-%d.googlebot.com\n", a, b, c, a, b, c
+    }
+}' > "$WORK/fixture"
+
+# modules httpd was not built with
+LIBEXEC=$($APXS -q LIBEXECDIR)
+STATIC=$("$HTTPD" -l)
+: > "$WORK/modules.conf"
+for m in mpm_event authz_core unixd dir mime remoteip; do
+    case "$STATIC" in
+    *"mod_$m.c"*) ;;
+    *) echo "LoadModule ${m}_module $LIBEXEC/mod_$m.so" >> "$WORK/modules.conf" ;;
+    esac
+done
+
+mkdir -p "$WORK/htdocs" "$WORK/logs"
+echo ok > "$WORK/htdocs/index.html"
+
+cat > "$WORK/httpd.conf" <<EOF
+ServerRoot "$WORK"
+ServerName 127.0.0.1
+Listen 127.0.0.1:$PORT
+PidFile "$WORK/httpd.pid"
+ErrorLog "$WORK/logs/error_log"
+LogLevel warn
+Include "$WORK/modules.conf"
+LoadModule wl_module "$WORK/.libs/mod_wl.so"
+DocumentRoot "$WORK/htdocs"
+DirectoryIndex index.html
+KeepAlive On
+MaxKeepAliveRequests 0
+StartServers 2
+ThreadsPerChild 64
+MaxRequestWorkers 256
+
+RemoteIPHeader X-Forwarded-For
+RemoteIPInternalProxy 127.0.0.1
+
+WLEnabled On
+WLBot "Googlebot"
+WLDnsServer 127.0.0.1:$DNSPORT
+WLDnsTimeout $DNS_TIMEOUT
+WLSharedSlots $((REQUESTS * 4))
+EOF
+
+start_dns() {
+    [ -n "$DNSPID" ] && kill "$DNSPID" 2>/dev/null && wait "$DNSPID" 2>/dev/null || true
+    ./bench/wl_fakedns -f "$WORK/fixture" -p "$DNSPORT" "$@" &
+    DNSPID=$!
+    sleep 1
+}
+
+load() {
+    label=$1
+    shift
+    echo "wl_e2e: $label" >&2
+    ./bench/wl_load -a "$WORK/fixture" -p "$PORT" -n "$REQUESTS" -c "$CONNS" -l "$label" "$@"
+}
+
+start_dns -l "$LATENCY" -j "$JITTER"
+"$HTTPD" -f "$WORK/httpd.conf" -k start
+sleep 2
+
+COLD=$(load cold -s 0 -k "$REQUESTS")
+WARM=$(load warm -s 0 -k "$REQUESTS")
+
+start_dns -l "$BROWN_LATENCY" -j "$BROWN_JITTER" -d "$BROWN_DROP" -m "$BROWN_MISMATCH"
+BROWN=$(load brownout -s "$REQUESTS" -k "$BROWN_REQUESTS" -n "$BROWN_REQUESTS")
+
+printf '{\n  "cold": %s,\n  "warm": %s,\n  "brownout": %s\n}\n' "$COLD" "$WARM" "$BROWN" > "$OUT"
+cat "$OUT"
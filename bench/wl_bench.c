@@ -0,0 +1,557 @@
+/* 
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ *
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ /*
+ * wl_bench.c
+ *
+ * Micro-benchmarks for the matching core outside
+ * httpd: list lookups and load times for growing
+ * list sizes, lookups in threat feed sized lists
+ * with and without a filter in front, and user
+ * agent scans over a corpus. Results are written
+ * as JSON.
+ *
+ * usage: wl_bench [-o results.json] [-s 1000,10000,...]
+ *                 [-n lookups] [-d tmpdir]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wl_match.h"
+
+#define WL_BENCH_BATCH 64           /* lookups timed together */
+#define WL_BENCH_SIZES "1000,10000,100000,1000000,10000000"
+#define WL_BENCH_LOOKUPS 2000000
+#define WL_BENCH_SCANS 200000
+#define WL_BENCH_FILTER_RATE 0.01
+#define WL_BENCH_FEED_HITS 100      /* one query in this many is listed */
+
+struct wl_bench_stats {
+    double                   rate;
+    double                    p50;
+    double                    p99;
+};
+
+static const char* wl_bench_agents[] = {
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36",
+    "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4 Safari/605.1.15",
+    "Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0",
+    "Mozilla/5.0 (iPhone; CPU iPhone OS 17_4 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4 Mobile/15E148 Safari/604.1",
+    "Mozilla/5.0 (Linux; Android 14; Pixel 8) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.6367.82 Mobile Safari/537.36",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36 Edg/124.0.2478.67",
+    "Mozilla/5.0 (compatible; Googlebot/2.1; +http://www.google.com/bot.html)",
+    "Mozilla/5.0 AppleWebKit/537.36 (KHTML, like Gecko; compatible; Googlebot/2.1; +http://www.google.com/bot.html) Chrome/124.0.6367.118 Safari/537.36",
+    "Googlebot-Image/1.0",
+    "Mozilla/5.0 (compatible; bingbot/2.0; +http://www.bing.com/bingbot.htm)",
+    "Mozilla/5.0 (compatible; YandexBot/3.0; +http://yandex.com/bots)",
+    "Mozilla/5.0 (compatible; Baiduspider/2.0; +http://www.baidu.com/search/spider.html)",
+    "DuckDuckBot/1.1; (+http://duckduckgo.com/duckduckbot.html)",
+    "Mozilla/5.0 (compatible; Yahoo! Slurp; http://help.yahoo.com/help/us/ysearch/slurp)",
+    "facebookexternalhit/1.1 (+http://www.facebook.com/externalhit_uatext.php)",
+    "Mozilla/5.0 (compatible; AhrefsBot/7.0; +http://ahrefs.com/robot/)",
+    "Mozilla/5.0 (compatible; SemrushBot/7~bl; +http://www.semrush.com/bot.html)",
+    "curl/8.5.0",
+    "python-requests/2.31.0",
+    "Wget/1.21.4",
+    "",
+};
+
+static const char* wl_bench_bots[] = {
+    "Googlebot", "Googlebot-Image", "AdsBot-Google", "Mediapartners-Google",
+    "bingbot", "BingPreview", "msnbot", "Yahoo!Slurp", "YandexBot",
+    "YandexImages", "Baiduspider", "DuckDuckBot", "Applebot", "facebookexternalhit",
+    "Twitterbot", "LinkedInBot", "Pinterestbot", "Sogou", "Exabot", "ia_archiver",
+    NULL
+};
+
+static const char* wl_bench_regexes[] = {
+    "Googlebot/[0-9]+\\.[0-9]+", "Chrome/1[0-9][0-9]\\..*Mobile", "(Ahrefs|Semrush)Bot",
+    NULL
+};
+
+static uint64_t wl_bench_rng = 0x9E3779B97F4A7C15ull;
+
+/**
+ * xorshift64, deterministic between runs
+ */
+static uint32_t wl_bench_rand(void)
+{
+    wl_bench_rng ^= wl_bench_rng << 13;
+    wl_bench_rng ^= wl_bench_rng >> 7;
+    wl_bench_rng ^= wl_bench_rng << 17;
+    return (uint32_t) (wl_bench_rng >> 32);
+}
+
+static double wl_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int wl_bench_cmp(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * rate and percentiles from per-operation
+ * nanoseconds, one sample per batch
+ */
+static void wl_bench_summarize(double* samples, size_t n, double total_ns, double ops, struct wl_bench_stats* st)
+{
+    qsort(samples, n, sizeof(double), wl_bench_cmp);
+    st->rate = ops / (total_ns / 1e9);
+    st->p50 = samples[n / 2];
+    st->p99 = samples[(size_t) (n * 0.99)];
+}
+
+/**
+ * a random list entry: mostly single IPv4
+ * addresses, some IPv4 and IPv6 networks
+ */
+static void wl_bench_entry(struct wl_addr* a)
+{
+    uint32_t r = wl_bench_rand() % 10;
+
+    if (r < 9) {
+        a->net[0] = a->net[1] = 0;
+        a->net[2] = 0xFFFF;
+        a->net[3] = wl_bench_rand();
+        a->bits = WL_ADDR_V4 + (r < 8 ? 32 : 16 + wl_bench_rand() % 13);
+    } else {
+        a->net[0] = 0x20010000u | (wl_bench_rand() & 0xFFFF);
+        a->net[1] = wl_bench_rand();
+        a->net[2] = wl_bench_rand();
+        a->net[3] = wl_bench_rand();
+        a->bits = 48 + wl_bench_rand() % 81;
+    }
+}
+
+static void wl_bench_format(const struct wl_addr* a, char* buf, size_t len)
+{
+    if (a->net[0] == 0 && a->net[1] == 0 && a->net[2] == 0xFFFF) {
+        snprintf(buf, len, "%u.%u.%u.%u/%d\n", a->net[3] >> 24, (a->net[3] >> 16) & 0xFF,
+                 (a->net[3] >> 8) & 0xFF, a->net[3] & 0xFF, a->bits - WL_ADDR_V4);
+    } else {
+        snprintf(buf, len, "%x:%x:%x:%x:%x:%x:%x:%x/%d\n",
+                 a->net[0] >> 16, a->net[0] & 0xFFFF, a->net[1] >> 16, a->net[1] & 0xFFFF,
+                 a->net[2] >> 16, a->net[2] & 0xFFFF, a->net[3] >> 16, a->net[3] & 0xFFFF, a->bits);
+    }
+}
+
+/**
+ * build, load and query a list of n entries
+ */
+static int wl_bench_list(FILE* out, unsigned long n, unsigned long lookups, const char* dir, int first)
+{
+    struct wl_trie t = WL_TRIE_INIT;
+    struct wl_trie r = WL_TRIE_INIT;
+    struct wl_trie m = WL_TRIE_INIT;
+    struct wl_bench_stats st;
+    struct wl_addr a;
+    uint32_t (*queries)[4];
+    uint32_t swap[4];
+    int host;
+    double* samples;
+    double t0, t1, build, load_text, load_index, total = 0;
+    char text[4096], index[4096], line[64];
+    unsigned long i, j, nq, bad, hits = 0;
+    size_t nb;
+    FILE* fp;
+
+    snprintf(text, sizeof(text), "%s/wl_bench_%lu.wl", dir, n);
+    snprintf(index, sizeof(index), "%s/wl_bench_%lu.wlb", dir, n);
+
+    fp = fopen(text, "w");
+    if (fp == NULL) {
+        perror(text);
+        return -1;
+    }
+
+    nq = lookups < n * 16 ? lookups : n * 16;
+    nq -= nq % WL_BENCH_BATCH;
+    queries = malloc(nq * sizeof(*queries));
+    samples = malloc(nq / WL_BENCH_BATCH * sizeof(double));
+    if (queries == NULL || samples == NULL) {
+        fprintf(stderr, "wl_bench: out of memory\n");
+        return -1;
+    }
+
+    /* the first half of the queries falls inside listed networks */
+    build = 0;
+    for (i = 0; i < n; i++) {
+        wl_bench_entry(&a);
+        wl_bench_format(&a, line, sizeof(line));
+        fputs(line, fp);
+
+        t0 = wl_bench_now();
+        if (wl_trie_insert(&t, &a) != 0) {
+            fprintf(stderr, "wl_bench: out of memory\n");
+            return -1;
+        }
+        build += wl_bench_now() - t0;
+
+        if (nq / 2 > 0) {
+            j = i % (nq / 2);
+            host = WL_ADDR_BITS - a.bits;
+            memcpy(queries[j], a.net, sizeof(a.net));
+            queries[j][3] ^= wl_bench_rand() & (host >= 32 ? 0xFFFFFFFFu : (1u << host) - 1);
+        }
+    }
+    fclose(fp);
+
+    for (j = n; j < nq / 2; j++)
+        memcpy(queries[j], queries[j % n], sizeof(swap));
+    for (j = nq / 2; j < nq; j++) {
+        wl_bench_entry(&a);
+        memcpy(queries[j], a.net, sizeof(a.net));
+    }
+    for (j = nq; j > 1; j--) {
+        i = wl_bench_rand() % j;
+        memcpy(swap, queries[i], sizeof(swap));
+        memcpy(queries[i], queries[j - 1], sizeof(swap));
+        memcpy(queries[j - 1], swap, sizeof(swap));
+    }
+
+    t0 = wl_bench_now();
+    if (wl_trie_read(&r, text, NULL, NULL, &bad) != WL_INDEX_OK) {
+        perror(text);
+        return -1;
+    }
+    load_text = wl_bench_now() - t0;
+    wl_trie_free(&r);
+
+    if (wl_trie_write(&t, index) != WL_INDEX_OK) {
+        perror(index);
+        return -1;
+    }
+    t0 = wl_bench_now();
+    if (wl_trie_map(&m, index) != WL_INDEX_OK) {
+        perror(index);
+        return -1;
+    }
+    load_index = wl_bench_now() - t0;
+    wl_trie_free(&m);
+
+    wl_trie_compact(&t);
+
+    /* warm up, then time batches of lookups */
+    for (j = 0; j < nq; j++)
+        hits += wl_trie_lookup(&t, queries[j]) >= 0;
+
+    nb = 0;
+    hits = 0;
+    for (j = 0; j < nq; j += WL_BENCH_BATCH) {
+        t0 = wl_bench_now();
+        for (i = j; i < j + WL_BENCH_BATCH; i++)
+            hits += wl_trie_lookup(&t, queries[i]) >= 0;
+        t1 = wl_bench_now();
+        total += t1 - t0;
+        samples[nb++] = (t1 - t0) / WL_BENCH_BATCH;
+    }
+    wl_bench_summarize(samples, nb, total, nq, &st);
+
+    fprintf(out, "%s    {\"entries\": %lu, \"nodes\": %u, \"bytes\": %lu, \"build_ms\": %.3f, "
+            "\"load_text_ms\": %.3f, \"load_index_ms\": %.3f, \"lookups\": %lu, \"hit_ratio\": %.3f, "
+            "\"lookups_per_sec\": %.0f, \"p50_ns\": %.1f, \"p99_ns\": %.1f}",
+            first ? "" : ",\n", n, t.count, (unsigned long) wl_trie_bytes(&t), build / 1e6,
+            load_text / 1e6, load_index / 1e6, nq, (double) hits / nq, st.rate, st.p50, st.p99);
+    fflush(out);
+
+    unlink(text);
+    unlink(index);
+    wl_trie_free(&t);
+    free(queries);
+    free(samples);
+    return 0;
+}
+
+/**
+ * time lookups of every query in batches, through
+ * the filter first when one is given
+ */
+static unsigned long wl_bench_lookups(const struct wl_trie* t, const struct wl_bloom* b, uint32_t (*queries)[4],
+                                      unsigned long nq, double* samples, struct wl_bench_stats* st)
+{
+    double t0, t1, total = 0;
+    unsigned long i, j, hits = 0;
+    size_t nb = 0;
+
+    for (j = 0; j < nq; j++)
+        hits += (b == NULL || wl_bloom_maybe(b, queries[j])) && wl_trie_lookup(t, queries[j]) >= 0;
+
+    hits = 0;
+    for (j = 0; j < nq; j += WL_BENCH_BATCH) {
+        t0 = wl_bench_now();
+        for (i = j; i < j + WL_BENCH_BATCH; i++)
+            hits += (b == NULL || wl_bloom_maybe(b, queries[i])) && wl_trie_lookup(t, queries[i]) >= 0;
+        t1 = wl_bench_now();
+        total += t1 - t0;
+        samples[nb++] = (t1 - t0) / WL_BENCH_BATCH;
+    }
+    wl_bench_summarize(samples, nb, total, nq, st);
+
+    return hits;
+}
+
+/**
+ * a threat feed of n single addresses, mostly IPv4,
+ * queried by addresses that almost all miss it, with
+ * the trie alone and with a filter in front
+ */
+static int wl_bench_feed(FILE* out, unsigned long n, unsigned long lookups, int first)
+{
+    struct wl_trie t = WL_TRIE_INIT;
+    struct wl_bloom b = WL_BLOOM_INIT;
+    struct wl_bench_stats plain, filtered;
+    struct wl_addr a;
+    uint32_t (*queries)[4];
+    double* samples;
+    double t0, build;
+    unsigned long i, nq, nh, hits, passed = 0, misses = 0;
+
+    nq = lookups - lookups % WL_BENCH_BATCH;
+    nh = nq / WL_BENCH_FEED_HITS < n ? nq / WL_BENCH_FEED_HITS : n;
+    queries = malloc(nq * sizeof(*queries));
+    samples = malloc(nq / WL_BENCH_BATCH * sizeof(double));
+    if (queries == NULL || samples == NULL) {
+        fprintf(stderr, "wl_bench: out of memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        wl_bench_entry(&a);
+        a.bits = WL_ADDR_BITS;
+        if (wl_trie_insert(&t, &a) != 0) {
+            fprintf(stderr, "wl_bench: out of memory\n");
+            return -1;
+        }
+        if (i < nh)
+            memcpy(queries[i * WL_BENCH_FEED_HITS], a.net, sizeof(a.net));
+    }
+    wl_trie_compact(&t);
+
+    for (i = 0; i < nq; i++) {
+        if (i % WL_BENCH_FEED_HITS == 0 && i / WL_BENCH_FEED_HITS < nh)
+            continue;
+        wl_bench_entry(&a);
+        memcpy(queries[i], a.net, sizeof(a.net));
+    }
+
+    t0 = wl_bench_now();
+    if (wl_bloom_build(&b, &t, WL_BENCH_FILTER_RATE) != WL_INDEX_OK) {
+        fprintf(stderr, "wl_bench: could not build the filter\n");
+        return -1;
+    }
+    build = wl_bench_now() - t0;
+
+    for (i = 0; i < nq; i++) {
+        if (wl_trie_lookup(&t, queries[i]) < 0) {
+            misses++;
+            passed += wl_bloom_maybe(&b, queries[i]);
+        }
+    }
+
+    hits = wl_bench_lookups(&t, NULL, queries, nq, samples, &plain);
+    wl_bench_lookups(&t, &b, queries, nq, samples, &filtered);
+
+    fprintf(out, "%s    {\"entries\": %lu, \"trie_bytes\": %lu, \"filter_bytes\": %lu, \"filter_build_ms\": %.3f, "
+            "\"rate\": %g, \"false_positives\": %.5f, \"lookups\": %lu, \"hit_ratio\": %.3f, "
+            "\"trie_lookups_per_sec\": %.0f, \"trie_p50_ns\": %.1f, \"trie_p99_ns\": %.1f, "
+            "\"filtered_lookups_per_sec\": %.0f, \"filtered_p50_ns\": %.1f, \"filtered_p99_ns\": %.1f}",
+            first ? "" : ",\n", n, (unsigned long) wl_trie_bytes(&t), (unsigned long) b.bytes, build / 1e6,
+            WL_BENCH_FILTER_RATE, misses ? (double) passed / misses : 0, nq, (double) hits / nq,
+            plain.rate, plain.p50, plain.p99, filtered.rate, filtered.p50, filtered.p99);
+    fflush(out);
+
+    wl_bloom_free(&b);
+    wl_trie_free(&t);
+    free(queries);
+    free(samples);
+    return 0;
+}
+
+/**
+ * scan the user agent corpus with a pattern set,
+ * the way mod_wl does: literals first, then the
+ * expressions over the agent without spaces
+ */
+static int wl_bench_agents_run(FILE* out, const char* name, int with_regex, unsigned long scans, int first)
+{
+    struct wl_bot_list* bots = NULL;
+    struct wl_bot_list* b;
+    struct wl_matcher* m;
+    struct wl_bench_stats st;
+    const char* badre;
+    double* samples;
+    double t0, t1, total = 0, build;
+    char stripped[512];
+    size_t nagents = sizeof(wl_bench_agents) / sizeof(wl_bench_agents[0]);
+    unsigned long i, k, nb = 0, matched = 0, npat = 0;
+    const char* p;
+    char* q;
+    int found;
+
+    for (i = 0; wl_bench_bots[i] != NULL; i++, npat++) {
+        b = calloc(1, sizeof(*b));
+        b->name = (char*) wl_bench_bots[i];
+        b->literal = 1;
+        b->next = bots;
+        bots = b;
+    }
+    for (i = 0; with_regex && wl_bench_regexes[i] != NULL; i++, npat++) {
+        b = calloc(1, sizeof(*b));
+        b->name = (char*) wl_bench_regexes[i];
+        b->literal = wl_bot_is_literal(b->name);
+        b->next = bots;
+        bots = b;
+    }
+
+    t0 = wl_bench_now();
+    if (wl_matcher_build(bots, &m, &badre) != WL_MATCHER_OK) {
+        fprintf(stderr, "wl_bench: could not build matcher\n");
+        return -1;
+    }
+    build = wl_bench_now() - t0;
+
+    samples = malloc(scans / nagents * sizeof(double) + sizeof(double));
+    if (samples == NULL)
+        return -1;
+
+    for (k = 0; k + nagents <= scans; k += nagents) {
+        matched = 0;
+        t0 = wl_bench_now();
+        for (i = 0; i < nagents; i++) {
+            found = wl_matcher_scan(m, wl_bench_agents[i]) != NULL;
+            if (!found && m->nrgx > 0) {
+                for (p = wl_bench_agents[i], q = stripped; *p && q < stripped + sizeof(stripped) - 1; p++)
+                    if (*p != ' ')
+                        *q++ = *p;
+                *q = '\0';
+                found = wl_matcher_regex(m, stripped) != NULL;
+            }
+            matched += found;
+        }
+        t1 = wl_bench_now();
+        total += t1 - t0;
+        samples[nb++] = (t1 - t0) / nagents;
+    }
+    wl_bench_summarize(samples, nb, total, (double) nb * nagents, &st);
+
+    fprintf(out, "%s    {\"corpus\": \"%s\", \"agents\": %lu, \"patterns\": %lu, \"expressions\": %d, "
+            "\"states\": %d, \"build_us\": %.1f, \"matched\": %lu, \"scans_per_sec\": %.0f, "
+            "\"p50_ns\": %.1f, \"p99_ns\": %.1f}",
+            first ? "" : ",\n", name, (unsigned long) nagents, npat, m->nrgx, m->nstates,
+            build / 1e3, matched, st.rate, st.p50, st.p99);
+    fflush(out);
+
+    wl_matcher_free(m);
+    while (bots != NULL) {
+        b = bots->next;
+        free(bots);
+        bots = b;
+    }
+    free(samples);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* sizes = WL_BENCH_SIZES;
+    const char* dir = "/tmp";
+    unsigned long lookups = WL_BENCH_LOOKUPS, n;
+    FILE* out = stdout;
+    char* list;
+    char* tok;
+    int c, first = 1;
+
+    while ((c = getopt(argc, argv, "o:s:n:d:")) != -1) {
+        switch (c) {
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 'n':
+            lookups = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-o results.json] [-s 1000,10000,...] [-n lookups] [-d tmpdir]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (lookups < WL_BENCH_BATCH)
+        lookups = WL_BENCH_BATCH;
+
+    fprintf(out, "{\n  \"benchmark\": \"wl_match\",\n  \"batch\": %d,\n  \"lists\": [\n", WL_BENCH_BATCH);
+
+    list = strdup(sizes);
+    for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        n = strtoul(tok, NULL, 10);
+        if (n == 0)
+            continue;
+        fprintf(stderr, "wl_bench: list of %lu entries\n", n);
+        if (wl_bench_list(out, n, lookups, dir, first) != 0)
+            return 1;
+        first = 0;
+    }
+    free(list);
+
+    fprintf(out, "\n  ],\n  \"filters\": [\n");
+
+    first = 1;
+    list = strdup(sizes);
+    for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        n = strtoul(tok, NULL, 10);
+        if (n == 0)
+            continue;
+        fprintf(stderr, "wl_bench: feed of %lu addresses\n", n);
+        if (wl_bench_feed(out, n, lookups, first) != 0)
+            return 1;
+        first = 0;
+    }
+    free(list);
+
+    fprintf(out, "\n  ],\n  \"agents\": [\n");
+    if (wl_bench_agents_run(out, "literals", 0, WL_BENCH_SCANS, 1) != 0
+        || wl_bench_agents_run(out, "literals+regex", 1, WL_BENCH_SCANS, 0) != 0)
+        return 1;
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,507 @@
+/* 
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ *
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ /*
+ * wl_fakedns.c
+ *
+ * A loopback DNS stand-in for load testing the
+ * reverse / forward verification path. Answers
+ * PTR, A and AAAA queries from a fixture file,
+ * with configurable latency, drop and mismatch
+ * rates.
+ *
+ * Fixture lines are "address hostname": the address
+ * gets a PTR record for the hostname and the hostname
+ * an A or AAAA record for the address. Blank lines
+ * and lines starting with # are skipped.
+ *
+ * usage: wl_fakedns -f fixture [-b 127.0.0.1] [-p 5300]
+ *                   [-l latency_ms] [-j jitter_ms]
+ *                   [-d drop_rate] [-m mismatch_rate]
+ *
+ * SIGUSR1 prints the counters, SIGINT / SIGTERM
+ * print them and exit.
+ */
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WL_FAKEDNS_PENDING 8192     /* replies waiting for their latency */
+#define WL_FAKEDNS_MSG 512
+#define WL_FAKEDNS_NAME 256
+#define WL_FAKEDNS_MAX_ANSWERS 16
+#define WL_DNS_T_A 1
+#define WL_DNS_T_PTR 12
+#define WL_DNS_T_AAAA 28
+#define WL_DNS_NXDOMAIN 3
+#define WL_DNS_SERVFAIL 2
+
+struct wl_fakedns_rec {
+    char*                    name;  /* reverse name for PTR, hostname for A / AAAA */
+    char*                  target;  /* hostname for PTR */
+    int                     family;
+    unsigned char         addr[16];
+};
+
+struct wl_fakedns_pending {
+    double                    due;
+    struct sockaddr_storage    to;
+    socklen_t               tolen;
+    int                       len;
+    unsigned char  msg[WL_FAKEDNS_MSG];
+};
+
+static struct wl_fakedns_rec* wl_ptr;
+static struct wl_fakedns_rec* wl_fwd;
+static size_t wl_nrec;
+static struct wl_fakedns_pending wl_pending[WL_FAKEDNS_PENDING];
+static int wl_npending;
+static double wl_latency, wl_jitter, wl_drop, wl_mismatch;
+static uint64_t wl_rng = 0x2545F4914F6CDD1Dull;
+static volatile sig_atomic_t wl_stop, wl_report;
+
+static unsigned long wl_queries, wl_answered, wl_dropped, wl_mismatched, wl_nxdomain, wl_overflow;
+
+static double wl_fakedns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * uniform in [0, 1)
+ */
+static double wl_fakedns_rand(void)
+{
+    wl_rng ^= wl_rng << 13;
+    wl_rng ^= wl_rng >> 7;
+    wl_rng ^= wl_rng << 17;
+    return (wl_rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int wl_fakedns_cmp(const void* a, const void* b)
+{
+    return strcasecmp(((const struct wl_fakedns_rec*) a)->name, ((const struct wl_fakedns_rec*) b)->name);
+}
+
+/**
+ * in-addr.arpa or ip6.arpa name of an address
+ */
+static void wl_fakedns_reverse(int family, const unsigned char* a, char* out, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t o = 0;
+    int i;
+
+    if (family == AF_INET) {
+        snprintf(out, len, "%u.%u.%u.%u.in-addr.arpa", a[3], a[2], a[1], a[0]);
+        return;
+    }
+    for (i = 15; i >= 0 && o + 4 < len; i--) {
+        out[o++] = hex[a[i] & 0xF];
+        out[o++] = '.';
+        out[o++] = hex[a[i] >> 4];
+        out[o++] = '.';
+    }
+    snprintf(out + o, len - o, "ip6.arpa");
+}
+
+/**
+ * read the fixture into two sorted tables,
+ * reverse names and hostnames
+ *
+ * @param path -> fixture file
+ */
+static int wl_fakedns_load(const char* path)
+{
+    char line[1024], rev[WL_FAKEDNS_NAME], ip[128], host[WL_FAKEDNS_NAME];
+    struct wl_fakedns_rec r;
+    size_t cap = 0, len;
+    FILE* fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%127s %255s", ip, host) != 2 || ip[0] == '#')
+            continue;
+
+        memset(&r, 0, sizeof(r));
+        if (inet_pton(AF_INET, ip, r.addr) == 1) {
+            r.family = AF_INET;
+        } else if (inet_pton(AF_INET6, ip, r.addr) == 1) {
+            r.family = AF_INET6;
+        } else {
+            fprintf(stderr, "wl_fakedns: skipping bad address %s\n", ip);
+            continue;
+        }
+        len = strlen(host);
+        if (len > 0 && host[len - 1] == '.')
+            host[len - 1] = '\0';
+
+        if (wl_nrec == cap) {
+            cap = cap ? cap * 2 : 1024;
+            wl_ptr = realloc(wl_ptr, cap * sizeof(*wl_ptr));
+            wl_fwd = realloc(wl_fwd, cap * sizeof(*wl_fwd));
+            if (wl_ptr == NULL || wl_fwd == NULL) {
+                fprintf(stderr, "wl_fakedns: out of memory\n");
+                return -1;
+            }
+        }
+
+        wl_fakedns_reverse(r.family, r.addr, rev, sizeof(rev));
+        wl_fwd[wl_nrec] = r;
+        wl_fwd[wl_nrec].name = strdup(host);
+        wl_ptr[wl_nrec] = r;
+        wl_ptr[wl_nrec].name = strdup(rev);
+        wl_ptr[wl_nrec].target = wl_fwd[wl_nrec].name;
+        wl_nrec++;
+    }
+    fclose(fp);
+
+    qsort(wl_ptr, wl_nrec, sizeof(*wl_ptr), wl_fakedns_cmp);
+    qsort(wl_fwd, wl_nrec, sizeof(*wl_fwd), wl_fakedns_cmp);
+    return 0;
+}
+
+/**
+ * first record named name, or NULL
+ */
+static struct wl_fakedns_rec* wl_fakedns_find(struct wl_fakedns_rec* tab, const char* name)
+{
+    size_t lo = 0, hi = wl_nrec, mid;
+    int c;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        c = strcasecmp(tab[mid].name, name);
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < wl_nrec && strcasecmp(tab[lo].name, name) == 0 ? &tab[lo] : NULL;
+}
+
+static int wl_fakedns_put_name(unsigned char* msg, int off, const char* name)
+{
+    const char* dot;
+    size_t l;
+
+    while (*name) {
+        dot = strchr(name, '.');
+        l = dot ? (size_t) (dot - name) : strlen(name);
+        if (l == 0 || l > 63 || off + (int) l + 2 > WL_FAKEDNS_MSG)
+            return -1;
+        msg[off++] = (unsigned char) l;
+        memcpy(msg + off, name, l);
+        off += l;
+        name += l + (dot != NULL);
+    }
+    msg[off++] = 0;
+    return off;
+}
+
+static int wl_fakedns_put_rr(unsigned char* msg, int off, int type, const void* rdata, int rdlen)
+{
+    if (off + 12 + rdlen > WL_FAKEDNS_MSG)
+        return -1;
+    msg[off++] = 0xC0;                  /* pointer to the question name */
+    msg[off++] = 12;
+    msg[off++] = type >> 8;
+    msg[off++] = type & 0xFF;
+    msg[off++] = 0;
+    msg[off++] = 1;                     /* IN */
+    msg[off++] = 0;
+    msg[off++] = 0;
+    msg[off++] = 0;
+    msg[off++] = 60;                    /* TTL */
+    msg[off++] = rdlen >> 8;
+    msg[off++] = rdlen & 0xFF;
+    memcpy(msg + off, rdata, rdlen);
+    return off + rdlen;
+}
+
+/**
+ * build the reply to one query in place
+ *
+ * @param msg -> the query, overwritten by the reply
+ * @param len -> query length
+ * @return reply length, or -1 to stay silent
+ */
+static int wl_fakedns_answer(unsigned char* msg, int len)
+{
+    char qname[WL_FAKEDNS_NAME];
+    unsigned char rdata[WL_FAKEDNS_NAME];
+    struct wl_fakedns_rec* r;
+    size_t q = 0;
+    int off = 12, qtype, end, rdlen, ancount = 0, rcode = 0, family, alen;
+    int mismatch = wl_mismatch > 0 && wl_fakedns_rand() < wl_mismatch;
+
+    if (len < 17 || (msg[2] & 0x80) || msg[4] != 0 || msg[5] != 1)
+        return -1;
+
+    /* the question name, uncompressed */
+    while (off < len && msg[off] != 0) {
+        if ((msg[off] & 0xC0) || off + 1 + msg[off] >= len || q + msg[off] + 1 >= sizeof(qname))
+            return -1;
+        if (q > 0)
+            qname[q++] = '.';
+        memcpy(qname + q, msg + off + 1, msg[off]);
+        q += msg[off];
+        off += 1 + msg[off];
+    }
+    qname[q] = '\0';
+    end = off + 5;
+    if (end > len)
+        return -1;
+    qtype = (msg[off + 1] << 8) | msg[off + 2];
+
+    if (qtype == WL_DNS_T_PTR) {
+        r = wl_fakedns_find(wl_ptr, qname);
+        if (r == NULL) {
+            rcode = WL_DNS_NXDOMAIN;
+        } else {
+            /* a mismatched PTR names a host without records */
+            if (mismatch)
+                rdlen = wl_fakedns_put_name(rdata, 0, "mismatch.invalid");
+            else
+                rdlen = wl_fakedns_put_name(rdata, 0, r->target);
+            if (rdlen > 0 && (end = wl_fakedns_put_rr(msg, end, WL_DNS_T_PTR, rdata, rdlen)) > 0)
+                ancount++;
+        }
+    } else if (qtype == WL_DNS_T_A || qtype == WL_DNS_T_AAAA) {
+        family = qtype == WL_DNS_T_A ? AF_INET : AF_INET6;
+        alen = family == AF_INET ? 4 : 16;
+        r = wl_fakedns_find(wl_fwd, qname);
+        if (r == NULL)
+            rcode = WL_DNS_NXDOMAIN;
+        for (; r != NULL && r < wl_fwd + wl_nrec && strcasecmp(r->name, qname) == 0; r++) {
+            if (r->family != family || ancount >= WL_FAKEDNS_MAX_ANSWERS)
+                continue;
+            memcpy(rdata, r->addr, alen);
+            /* a mismatched forward answer points elsewhere */
+            if (mismatch)
+                rdata[alen - 1] ^= 0x80;
+            if ((end = wl_fakedns_put_rr(msg, end, qtype, rdata, alen)) < 0)
+                return -1;
+            ancount++;
+        }
+    } else {
+        rcode = WL_DNS_NXDOMAIN;
+    }
+
+    if (end < 0) {
+        end = off + 5;
+        rcode = WL_DNS_SERVFAIL;
+        ancount = 0;
+    }
+
+    if (rcode == WL_DNS_NXDOMAIN)
+        wl_nxdomain++;
+    if (mismatch && ancount > 0)
+        wl_mismatched++;
+
+    msg[2] = 0x80 | (msg[2] & 0x79) | 0x04;    /* QR, AA, keep RD */
+    msg[3] = 0x80 | rcode;                      /* RA */
+    msg[6] = ancount >> 8;
+    msg[7] = ancount & 0xFF;
+    msg[8] = msg[9] = msg[10] = msg[11] = 0;
+    return end;
+}
+
+static void wl_fakedns_signal(int sig)
+{
+    if (sig == SIGUSR1)
+        wl_report = 1;
+    else
+        wl_stop = 1;
+}
+
+static void wl_fakedns_counters(void)
+{
+    fprintf(stderr, "wl_fakedns: queries %lu answered %lu dropped %lu mismatched %lu nxdomain %lu overflow %lu\n",
+            wl_queries, wl_answered, wl_dropped, wl_mismatched, wl_nxdomain, wl_overflow);
+}
+
+/**
+ * send every reply whose latency has passed
+ *
+ * @return ms until the next one is due, -1 if none
+ */
+static int wl_fakedns_flush(int fd)
+{
+    double now = wl_fakedns_now(), next = -1;
+    int i;
+
+    for (i = 0; i < wl_npending;) {
+        if (wl_pending[i].due <= now) {
+            sendto(fd, wl_pending[i].msg, wl_pending[i].len, 0,
+                   (struct sockaddr*) &wl_pending[i].to, wl_pending[i].tolen);
+            wl_answered++;
+            wl_pending[i] = wl_pending[--wl_npending];
+            continue;
+        }
+        if (next < 0 || wl_pending[i].due < next)
+            next = wl_pending[i].due;
+        i++;
+    }
+    return next < 0 ? -1 : (int) (next - now) + 1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* fixture = NULL;
+    const char* bind_addr = "127.0.0.1";
+    int port = 5300, c, fd, len, timeout;
+    struct sockaddr_storage ss;
+    struct sockaddr_in* sin = (struct sockaddr_in*) &ss;
+    struct sockaddr_in6* sin6 = (struct sockaddr_in6*) &ss;
+    struct wl_fakedns_pending* p;
+    struct sigaction sa;
+    struct pollfd pfd;
+    socklen_t sslen;
+    double delay;
+
+    while ((c = getopt(argc, argv, "f:b:p:l:j:d:m:")) != -1) {
+        switch (c) {
+        case 'f':
+            fixture = optarg;
+            break;
+        case 'b':
+            bind_addr = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'l':
+            wl_latency = atof(optarg);
+            break;
+        case 'j':
+            wl_jitter = atof(optarg);
+            break;
+        case 'd':
+            wl_drop = atof(optarg);
+            break;
+        case 'm':
+            wl_mismatch = atof(optarg);
+            break;
+        default:
+            fixture = NULL;
+            optind = argc;
+            break;
+        }
+    }
+    if (fixture == NULL) {
+        fprintf(stderr, "usage: %s -f fixture [-b address] [-p port] [-l latency_ms] [-j jitter_ms]"
+                " [-d drop_rate] [-m mismatch_rate]\n", argv[0]);
+        return 2;
+    }
+
+    if (wl_fakedns_load(fixture) != 0)
+        return 1;
+
+    memset(&ss, 0, sizeof(ss));
+    if (inet_pton(AF_INET, bind_addr, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sslen = sizeof(*sin);
+    } else if (inet_pton(AF_INET6, bind_addr, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        sslen = sizeof(*sin6);
+    } else {
+        fprintf(stderr, "wl_fakedns: bad bind address %s\n", bind_addr);
+        return 2;
+    }
+
+    fd = socket(ss.ss_family, SOCK_DGRAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*) &ss, sslen) != 0) {
+        perror("wl_fakedns: bind");
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = wl_fakedns_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    fprintf(stderr, "wl_fakedns: %lu records on %s port %d, latency %.1f+-%.1f ms, drop %.3f, mismatch %.3f\n",
+            (unsigned long) wl_nrec, bind_addr, port, wl_latency, wl_jitter, wl_drop, wl_mismatch);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    timeout = -1;
+    while (!wl_stop) {
+        if (wl_report) {
+            wl_report = 0;
+            wl_fakedns_counters();
+        }
+
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+            break;
+
+        while (pfd.revents & POLLIN) {
+            if (wl_npending == WL_FAKEDNS_PENDING) {
+                wl_overflow++;
+                break;
+            }
+            p = &wl_pending[wl_npending];
+            p->tolen = sizeof(p->to);
+            len = recvfrom(fd, p->msg, sizeof(p->msg), MSG_DONTWAIT, (struct sockaddr*) &p->to, &p->tolen);
+            if (len < 0)
+                break;
+            wl_queries++;
+
+            if (wl_drop > 0 && wl_fakedns_rand() < wl_drop) {
+                wl_dropped++;
+                continue;
+            }
+            p->len = wl_fakedns_answer(p->msg, len);
+            if (p->len < 0)
+                continue;
+
+            delay = wl_latency + (wl_jitter > 0 ? (wl_fakedns_rand() * 2 - 1) * wl_jitter : 0);
+            p->due = wl_fakedns_now() + (delay > 0 ? delay : 0);
+            wl_npending++;
+        }
+
+        timeout = wl_fakedns_flush(fd);
+    }
+
+    wl_fakedns_counters();
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,395 @@
+/* 
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ *
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ /*
+ * wl_load.c
+ *
+ * HTTP/1.1 keep-alive load generator for the mod_wl
+ * verification path. Each request carries a client
+ * address in X-Forwarded-For (picked up by mod_remoteip)
+ * and a bot User-Agent, so every new address costs
+ * mod_wl a reverse / forward lookup. Prints one JSON
+ * object with throughput and latency percentiles.
+ *
+ * usage: wl_load -a addresses [-h 127.0.0.1] [-p 8080]
+ *                [-c connections] [-n requests]
+ *                [-s first] [-k count] [-u path]
+ *                [-A agent] [-l label]
+ *
+ * Requests take addresses -s .. -s + -k - 1 from the
+ * file (first column, # comments skipped), in order
+ * and wrapping around.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WL_LOAD_AGENT "Mozilla/5.0 (compatible; Googlebot/2.1; +http://www.google.com/bot.html)"
+#define WL_LOAD_BUF 16384
+
+struct wl_load_conf {
+    const char*              host;
+    const char*              port;
+    const char*              path;
+    const char*             agent;
+    char**                  addrs;
+    unsigned long           naddr;
+    unsigned long        requests;
+};
+
+struct wl_load_result {
+    unsigned long          status[6];  /* by class, [0] for errors */
+    unsigned long       reconnects;
+};
+
+static struct wl_load_conf wl_conf;
+static double* wl_lat;              /* ms, one per request */
+static unsigned long wl_next;
+
+static double wl_load_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int wl_load_cmp(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int wl_load_connect(void)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(wl_conf.host, wl_conf.port, &hints, &res) != 0)
+        return -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int wl_load_send(int fd, const char* buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * read one response, headers and a Content-Length
+ * or chunked body
+ *
+ * @param keep -> set to 0 when the server closes
+ * @return HTTP status, or -1
+ */
+static int wl_load_response(int fd, char* buf, int* keep)
+{
+    size_t have = 0, need;
+    ssize_t n;
+    char* eoh = NULL;
+    char* p;
+    long clen = -1, chunk;
+    int status, chunked = 0;
+
+    while (eoh == NULL) {
+        if (have == WL_LOAD_BUF - 1)
+            return -1;
+        n = recv(fd, buf + have, WL_LOAD_BUF - 1 - have, 0);
+        if (n <= 0)
+            return -1;
+        have += n;
+        buf[have] = '\0';
+        eoh = strstr(buf, "\r\n\r\n");
+    }
+    if (sscanf(buf, "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+
+    *eoh = '\0';
+    *keep = 1;
+    for (p = strstr(buf, "\r\n"); p != NULL; p = strstr(p + 2, "\r\n")) {
+        if (strncasecmp(p + 2, "Content-Length:", 15) == 0)
+            clen = strtol(p + 17, NULL, 10);
+        else if (strncasecmp(p + 2, "Transfer-Encoding:", 18) == 0 && strstr(p + 20, "chunked") != NULL)
+            chunked = 1;
+        else if (strncasecmp(p + 2, "Connection:", 11) == 0 && strstr(p + 13, "close") != NULL)
+            *keep = 0;
+    }
+
+    /* body bytes already read, moved to the front */
+    have -= eoh + 4 - buf;
+    memmove(buf, eoh + 4, have);
+    buf[have] = '\0';
+
+    if (!chunked) {
+        if (clen < 0) {
+            *keep = 0;
+            return status;
+        }
+        while ((long) have < clen) {
+            n = recv(fd, buf, WL_LOAD_BUF - 1, 0);
+            if (n <= 0)
+                return -1;
+            have += n;
+        }
+        return status;
+    }
+
+    /* chunked: size line, data, CRLF, until the 0 chunk */
+    for (;;) {
+        while ((p = strstr(buf, "\r\n")) == NULL) {
+            if (have == WL_LOAD_BUF - 1 || (n = recv(fd, buf + have, WL_LOAD_BUF - 1 - have, 0)) <= 0)
+                return -1;
+            have += n;
+            buf[have] = '\0';
+        }
+        chunk = strtol(buf, NULL, 16);
+        need = (p + 2 - buf) + chunk + 2;
+        while (have < need) {
+            if (have == WL_LOAD_BUF - 1) {
+                /* a large chunk, discard what we have */
+                need -= have;
+                have = 0;
+            }
+            n = recv(fd, buf + have, WL_LOAD_BUF - 1 - have, 0);
+            if (n <= 0)
+                return -1;
+            have += n;
+        }
+        have -= need;
+        memmove(buf, buf + need, have);
+        buf[have] = '\0';
+        if (chunk == 0)
+            return status;
+    }
+}
+
+static void* wl_load_worker(void* arg)
+{
+    struct wl_load_result* res = arg;
+    char req[2048];
+    char* buf = malloc(WL_LOAD_BUF);
+    unsigned long i;
+    double t0;
+    int fd = -1, len, status, keep;
+
+    if (buf == NULL)
+        return NULL;
+
+    while ((i = __sync_fetch_and_add(&wl_next, 1)) < wl_conf.requests) {
+        len = snprintf(req, sizeof(req),
+                       "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: %s\r\nX-Forwarded-For: %s\r\n\r\n",
+                       wl_conf.path, wl_conf.host, wl_conf.agent, wl_conf.addrs[i % wl_conf.naddr]);
+
+        t0 = wl_load_now();
+        if (fd < 0) {
+            fd = wl_load_connect();
+            res->reconnects++;
+        }
+        status = -1;
+        if (fd >= 0 && wl_load_send(fd, req, len) == 0)
+            status = wl_load_response(fd, buf, &keep);
+        wl_lat[i] = wl_load_now() - t0;
+
+        if (status < 100 || status > 599) {
+            res->status[0]++;
+            keep = 0;
+        } else {
+            res->status[status / 100]++;
+        }
+        if (!keep && fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+/**
+ * first column of the fixture, from line first,
+ * at most count addresses (0 for all)
+ */
+static int wl_load_addrs(const char* path, unsigned long first, unsigned long count)
+{
+    char line[1024], ip[128];
+    unsigned long n = 0, cap = 0;
+    FILE* fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL && (count == 0 || wl_conf.naddr < count)) {
+        if (sscanf(line, "%127s", ip) != 1 || ip[0] == '#' || n++ < first)
+            continue;
+        if (wl_conf.naddr == cap) {
+            cap = cap ? cap * 2 : 1024;
+            wl_conf.addrs = realloc(wl_conf.addrs, cap * sizeof(char*));
+            if (wl_conf.addrs == NULL)
+                return -1;
+        }
+        wl_conf.addrs[wl_conf.naddr++] = strdup(ip);
+    }
+    fclose(fp);
+    return wl_conf.naddr > 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* addrfile = NULL;
+    const char* label = "run";
+    unsigned long first = 0, count = 0, i;
+    struct wl_load_result* res;
+    struct wl_load_result sum;
+    pthread_t* th;
+    double t0, elapsed;
+    int c, conns = 16, k;
+
+    wl_conf.host = "127.0.0.1";
+    wl_conf.port = "8080";
+    wl_conf.path = "/";
+    wl_conf.agent = WL_LOAD_AGENT;
+    wl_conf.requests = 10000;
+
+    while ((c = getopt(argc, argv, "a:h:p:c:n:s:k:u:A:l:")) != -1) {
+        switch (c) {
+        case 'a':
+            addrfile = optarg;
+            break;
+        case 'h':
+            wl_conf.host = optarg;
+            break;
+        case 'p':
+            wl_conf.port = optarg;
+            break;
+        case 'c':
+            conns = atoi(optarg);
+            break;
+        case 'n':
+            wl_conf.requests = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            first = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 'u':
+            wl_conf.path = optarg;
+            break;
+        case 'A':
+            wl_conf.agent = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            addrfile = NULL;
+            optind = argc;
+            break;
+        }
+    }
+    if (addrfile == NULL || conns < 1 || wl_conf.requests == 0) {
+        fprintf(stderr, "usage: %s -a addresses [-h host] [-p port] [-c connections] [-n requests]"
+                " [-s first] [-k count] [-u path] [-A agent] [-l label]\n", argv[0]);
+        return 2;
+    }
+    if (wl_load_addrs(addrfile, first, count) != 0) {
+        fprintf(stderr, "wl_load: no addresses in %s\n", addrfile);
+        return 1;
+    }
+
+    wl_lat = calloc(wl_conf.requests, sizeof(double));
+    res = calloc(conns, sizeof(*res));
+    th = calloc(conns, sizeof(*th));
+    if (wl_lat == NULL || res == NULL || th == NULL) {
+        fprintf(stderr, "wl_load: out of memory\n");
+        return 1;
+    }
+
+    t0 = wl_load_now();
+    for (k = 0; k < conns; k++) {
+        if (pthread_create(&th[k], NULL, wl_load_worker, &res[k]) != 0) {
+            fprintf(stderr, "wl_load: could not start thread %d\n", k);
+            return 1;
+        }
+    }
+    memset(&sum, 0, sizeof(sum));
+    for (k = 0; k < conns; k++) {
+        pthread_join(th[k], NULL);
+        for (i = 0; i < 6; i++)
+            sum.status[i] += res[k].status[i];
+        sum.reconnects += res[k].reconnects;
+    }
+    elapsed = wl_load_now() - t0;
+
+    qsort(wl_lat, wl_conf.requests, sizeof(double), wl_load_cmp);
+
+#define WL_LOAD_PCT(q) wl_lat[(unsigned long) ((wl_conf.requests - 1) * (q))]
+    printf("{\"label\": \"%s\", \"requests\": %lu, \"addresses\": %lu, \"connections\": %d, "
+           "\"seconds\": %.3f, \"requests_per_sec\": %.1f, "
+           "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"p999_ms\": %.3f, \"max_ms\": %.3f, "
+           "\"status\": {\"2xx\": %lu, \"3xx\": %lu, \"4xx\": %lu, \"5xx\": %lu, \"errors\": %lu}, "
+           "\"connects\": %lu}\n",
+           label, wl_conf.requests, wl_conf.naddr, conns, elapsed / 1e3, wl_conf.requests / (elapsed / 1e3),
+           WL_LOAD_PCT(0.5), WL_LOAD_PCT(0.9), WL_LOAD_PCT(0.99), WL_LOAD_PCT(0.999),
+           wl_lat[wl_conf.requests - 1], sum.status[2], sum.status[3], sum.status[4], sum.status[5],
+           sum.status[0] + sum.status[1], sum.reconnects);
+
+    return sum.status[0] == wl_conf.requests ? 1 : 0;
+}
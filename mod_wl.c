@@ -41,9 +41,14 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
 /* apache libraries */
 #include <string.h>
 #include "apr_hash.h"
+#include "apr_general.h"
 #include "ap_config.h"
 #include "ap_provider.h"
 #include "httpd.h"
@@ -51,48 +56,428 @@
 #include "http_config.h"
 #include "http_log.h"
 #include "http_protocol.h"
+#include "http_connection.h"
 #include "http_request.h"
+#include "ap_mpm.h"
 #include "apr_tables.h"
 #include "apr_strings.h"
+#include "apr_shm.h"
+#include "apr_mmap.h"
+#include "apr_atomic.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+
+#include "wl_match.h"
 
 
 #define WL_MODULE_DEBUG_MODE 1
+#define WL_MODULE_COUNT_ALLOCS 0    /* report heap allocations per request in MODWL_ALLOCS */
 #define WL_MODULE_STATUS_OK "OK"
 #define WL_MODULE_STATUS_FAIL "FAIL"
+#define WL_MODULE_STATUS_PENDING "PENDING"
 #define WL_MODULE_LOG_ID "mod_wl"
 
+#define WL_DNS_OK 0
+#define WL_DNS_NOTFOUND 1
+#define WL_DNS_TIMEOUT 2
+#define WL_DNS_ERROR 3
+
+#define WL_DNS_T_A 1
+#define WL_DNS_T_PTR 12
+#define WL_DNS_T_AAAA 28
+#define WL_DNS_PORT 53
+#define WL_DNS_MAX_NS 3
+#define WL_DNS_MAX_PACKET 4096
+#define WL_DNS_MAX_NAME 256
+#define WL_DNS_DEFAULT_TIMEOUT 1000 /* ms, WLDnsTimeout On */
+#define WL_DNS_RESOLV_TIMEOUT 5000  /* ms, WLDnsTimeout Off (resolv.conf default) */
+#define WL_DNS_RESOLV_CONF "/etc/resolv.conf"
+
+#define WL_VERDICT_NONE 0
+#define WL_VERDICT_OK 1
+#define WL_VERDICT_FAIL 2
+#define WL_VERDICT_DNSERR 3
+
+#define WL_TTL_OK 86400     /* seconds a verified address is trusted */
+#define WL_TTL_FAIL 3600    /* seconds a failed address stays rejected */
+#define WL_TTL_DNSERR 60    /* seconds before a DNS error is retried */
+
+#define WL_STORE_MAGIC 0x574C5634  /* "WLV4", 128-bit keys, CLOCK bits, domain tags */
+#define WL_STORE_SLOTS 65536
+#define WL_STORE_PROBE 8
+#define WL_STORE_FILE "mod_wl.shm"
+#define WL_SAVE_MAGIC 0x574C5333   /* "WLS3", verdicts saved by WLCacheSnapshot */
+#define WL_SAVE_VERSION 1          /* layout of struct wl_saved */
+#define WL_EARNED_ANY 0xffffffff   /* a verdict from WLList, good for any bot */
+#define WL_SAVE_INTERVAL 300       /* seconds between snapshots of the verdicts */
+
+#define WL_FLIGHT_FREE 0
+#define WL_FLIGHT_CLAIMING 1
+#define WL_FLIGHT_BUSY 2
+#define WL_FLIGHT_MIN 64            /* in-flight slots, at least two per request thread */
+#define WL_FLIGHT_GRACE 1000        /* ms a leader may take past its two lookups */
+#define WL_FLIGHT_POLL_MAX 16000    /* us between checks of a waiting request */
+
+#define WL_BREAKER_CLOSED 0
+#define WL_BREAKER_OPEN 1
+#define WL_BREAKER_HALF 2           /* one probe lookup is running */
+#define WL_BREAKER_WINDOW 10        /* seconds lookups are judged over */
+#define WL_BREAKER_MIN 20           /* lookups in a window before it can open */
+#define WL_BREAKER_BAD 50           /* percent of bad lookups that opens it */
+#define WL_BREAKER_COOLDOWN 30      /* seconds it stays open before a probe */
+
+#define WL_SHED_NONE 0
+#define WL_SHED_CHILD 1
+#define WL_SHED_SERVER 2
+#define WL_SHED_BREAKER 3
+
+#define WL_VERIFY_INLINE 0
+#define WL_VERIFY_BACKGROUND 1
+#define WL_CHECKER_THREADS 4        /* background verifications per child at once */
+#define WL_CHECKER_QUEUE 1024
+
+#define WL_RANGES_REFRESH 3600  /* seconds between checks of WLBotRanges files */
+
+#define WL_BOTS_AUTO_MAX 256    /* bots WLBotAutoAdd may add in a child */
+#define WL_BOTS_AUTO_QUEUE 64   /* added bots waiting for the writer */
+#define WL_RANGES_FILE "mod_wl.ranges"  /* compiled WLBotRanges, one per bot */
+
+#define WL_FILTER_RATE 0.01     /* false positive rate of list filters */
+#define WL_FILTER_MIN 100000    /* entries a list needs to be filtered */
+
+/* directives a config was given, the rest are
+ * inherited by wl_merge_config */
+#define WL_SET_ENABLED 0x0001
+#define WL_SET_LIST 0x0002
+#define WL_SET_LIST_APPEND 0x0004
+#define WL_SET_BLIST 0x0008
+#define WL_SET_BLIST_APPEND 0x0010
+#define WL_SET_BOTS 0x0020          /* WLBot, WLBotList */
+#define WL_SET_BOT_AUTO 0x0040
+#define WL_SET_DNS_TIMEOUT 0x0080
+#define WL_SET_DNS_SERVER 0x0100
+#define WL_SET_SLOTS 0x0200
+#define WL_SET_TTL 0x0400
+#define WL_SET_DNS_MAX 0x0800
+#define WL_SET_OVERLOAD 0x1000
+#define WL_SET_BREAKER 0x2000
+#define WL_SET_VERIFY 0x4000
+#define WL_SET_FLUSH_INTERVAL 0x8000
+#define WL_SET_FLUSH_BATCH 0x10000
+#define WL_SET_FLUSH_SYNC 0x20000
+#define WL_SET_REPORT 0x40000
+#define WL_SET_SPENV 0x80000
+#define WL_SET_REFRESH 0x100000
+#define WL_SET_FILTER 0x200000
+#define WL_SET_SAVE 0x400000
+#define WL_SET_BOTINFO 0x800000    /* WLBotRanges, WLBotDomains */
+
+#define WL_WRITER_INTERVAL 1000 /* ms between flushes of the append queue */
+#define WL_WRITER_BATCH 64
+#define WL_WRITER_QUEUE 4096
+#define WL_FSYNC_OFF 0
+#define WL_FSYNC_BATCH 1
+#define WL_FSYNC_ALWAYS 2
+
+#define WL_STATS_HANDLER "wl-status"
+#define WL_STATS_SLOTS 1024         /* counter slots when the MPM limits are unknown */
+#define WL_STATS_LINE 64            /* cache line counter slots are padded to */
+#define WL_STATS_BUCKETS 13
+
+/* request path counters, see wl_stat_names */
+#define WL_STAT_REQUESTS 0
+#define WL_STAT_WL_HITS 1
+#define WL_STAT_BL_HITS 2
+#define WL_STAT_CACHED_OK 3
+#define WL_STAT_CACHED_FAIL 4
+#define WL_STAT_CACHED_DNSERR 5
+#define WL_STAT_AGENT_SKIPPED 6
+#define WL_STAT_DNS_REVERSE 7
+#define WL_STAT_DNS_FORWARD 8
+#define WL_STAT_DNS_NOTFOUND 9      /* + WL_DNS_NOTFOUND - 1 .. */
+#define WL_STAT_DNS_TIMEOUT 10
+#define WL_STAT_DNS_FAILED 11
+#define WL_STAT_VERIFY_OK 12
+#define WL_STAT_VERIFY_FAIL 13
+#define WL_STAT_BOTS_ADDED 14
+#define WL_STAT_RANGE_HITS 15
+#define WL_STAT_DOMAIN_REJECTS 16
+#define WL_STAT_EVICTIONS 17
+#define WL_STAT_COALESCED 18
+#define WL_STAT_COALESCE_TIMEOUTS 19
+#define WL_STAT_CONN_REUSED 20
+#define WL_STAT_SHED_BUSY 21
+#define WL_STAT_SHED_BREAKER 22
+#define WL_STAT_BREAKER_OPENED 23
+#define WL_STAT_PENDING_PASS 24
+#define WL_STAT_CHECKS_QUEUED 25
+#define WL_STAT_CHECKS_DROPPED 26
+#define WL_STAT_FILTER_REJECTS 27
+#define WL_STAT_FILTER_FALSE 28
+#define WL_STAT_MAX 29
+
+#define WL_STAT_REVERSE 0
+#define WL_STAT_FORWARD 1
+
+/* httpd 2.2 has no per request log level */
+#ifndef APLOG_R_IS_LEVEL
+#define APLOG_R_IS_LEVEL(rec, level) ((rec)->server->loglevel >= (level))
+#endif
+
 #define AP_LOG_DEBUG(rec, fmt, ...) ap_log_rerror(APLOG_MARK, APLOG_DEBUG,  0, rec, fmt, ##__VA_ARGS__)
 #define AP_LOG_INFO(rec, fmt, ...)  ap_log_rerror(APLOG_MARK, APLOG_INFO,   0, rec, "[" WL_MODULE_LOG_ID "] " fmt, ##__VA_ARGS__)
 #define AP_LOG_WARN(rec, fmt, ...)  ap_log_rerror(APLOG_MARK, APLOG_WARNING,0, rec, "[" WL_MODULE_LOG_ID "] " fmt, ##__VA_ARGS__)
 #define AP_LOG_ERR(rec, fmt, ...)   ap_log_rerror(APLOG_MARK, APLOG_ERR,    0, rec, "[" WL_MODULE_LOG_ID "] " fmt, ##__VA_ARGS__)
 
+#define AP_SLOG_DEBUG(s, fmt, ...)  ap_log_error(APLOG_MARK, APLOG_DEBUG,   0, s, fmt, ##__VA_ARGS__)
+#define AP_SLOG_INFO(s, fmt, ...)   ap_log_error(APLOG_MARK, APLOG_INFO,    0, s, "[" WL_MODULE_LOG_ID "] " fmt, ##__VA_ARGS__)
+#define AP_SLOG_NOTICE(s, fmt, ...) ap_log_error(APLOG_MARK, APLOG_NOTICE,  0, s, "[" WL_MODULE_LOG_ID "] " fmt, ##__VA_ARGS__)
+#define AP_SLOG_WARN(s, fmt, ...)   ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, "[" WL_MODULE_LOG_ID "] " fmt, ##__VA_ARGS__)
+#define AP_SLOG_ERR(s, fmt, ...)    ap_log_error(APLOG_MARK, APLOG_ERR,     0, s, "[" WL_MODULE_LOG_ID "] " fmt, ##__VA_ARGS__)
+
 typedef struct {
     char*          wl_dns_forward;
     char*          wl_dns_reverse;
 } wl_dns_multi;
 
-struct wl_addr {
-  int bits;
-  int cidr;
-  const char* addr;
-  uint8_t* test;
+/* what a request matches user agents against.
+ * never changed once published: adding a bot builds
+ * a new snapshot sharing the old bot items and swaps
+ * it in, so readers hold no locks */
+struct wl_snapshot {
+    struct wl_matcher*    matcher;
+    struct wl_bot_list*      bots;
+};
+
+/* one verdict in shared memory. seq is a seqlock:
+ * odd while a writer owns the slot, readers retry
+ * when it changed under them. a slot past its
+ * expiry time is free. ref is the CLOCK bit, set
+ * by a hit and cleared as eviction passes over it.
+ * earned tags the WLBotDomains an OK was reached
+ * under, 0 for none */
+struct wl_slot {
+    volatile apr_uint32_t     seq;
+    volatile apr_uint32_t   ip[4];
+    volatile apr_uint32_t verdict;
+    volatile apr_uint32_t expires;
+    volatile apr_uint32_t     ref;
+    volatile apr_uint32_t  earned;
+};
+
+/* verdict table shared by every child. open addressing,
+ * a key lives within WL_STORE_PROBE slots of its hash */
+struct wl_store {
+    apr_uint32_t            magic;
+    apr_uint32_t           nslots;
+    struct wl_slot        slots[];
+};
+
+/* a WLCacheSnapshot file: the header, then count
+ * records of the verdicts alive when it was written.
+ * sum covers the records, the magic doubles as a
+ * byte order check, version and recsize name the
+ * record layout */
+struct wl_saved_header {
+    apr_uint32_t            magic;
+    apr_uint32_t          version;
+    apr_uint32_t          recsize;  /* sizeof(struct wl_saved) */
+    apr_uint32_t            count;
+    apr_uint32_t            saved;  /* seconds since the epoch */
+    apr_uint32_t              sum;
+};
+
+struct wl_saved {
+    apr_uint32_t            ip[4];
+    apr_uint32_t          expires;
+    apr_uint32_t           earned;
+    uint8_t               verdict;
+    uint8_t                   ref;
+    uint8_t                pad[2];
+};
+
+/* counters of one request thread. only the thread
+ * owning the slot writes it, so updates are plain
+ * increments; the status handler sums every slot */
+struct wl_stat_slot {
+    volatile apr_uint32_t    owner;  /* pid, 0 while free */
+    volatile apr_uint32_t    indns;  /* counted in wl_flights->busy */
+    apr_uint64_t count[WL_STAT_MAX];
+    apr_uint64_t dns[2][WL_STATS_BUCKETS];
+    apr_uint64_t         dns_us[2];
+};
+
+/* a slot rounded up to whole cache lines so two
+ * threads never write to the same line */
+union wl_stat_line {
+    struct wl_stat_slot       slot;
+    char pad[(sizeof(struct wl_stat_slot) + WL_STATS_LINE - 1) / WL_STATS_LINE * WL_STATS_LINE];
 };
 
+/* counters shared by every child, after the verdict
+ * table in the same segment. the slots start on the
+ * next cache line */
+struct wl_stats {
+    apr_uint32_t           nslots;
+    volatile apr_uint32_t    lost;  /* threads that found no free slot */
+    apr_time_t            started;
+};
+
+/* a verification in progress. the first request for
+ * an address claims a slot and does the lookups, the
+ * ones arriving meanwhile wait for it to free the slot
+ * and take its verdict from the verdict table. a slot
+ * whose leader died is free after its deadline */
+struct wl_flight {
+    volatile apr_uint32_t   state;  /* WL_FLIGHT_* */
+    volatile apr_uint32_t   token;  /* which claim holds it */
+    volatile apr_uint32_t   ip[4];
+    volatile apr_uint32_t deadline;  /* ms, wrapping */
+    volatile apr_uint32_t  served;  /* requests let through meanwhile, WLVerifyMode Background */
+};
+
+/* DNS health seen by every child. lookups are judged
+ * in windows of WL_BREAKER_WINDOW seconds, too many
+ * bad ones open the breaker. while open, verifications
+ * are shed until one probe after the cooldown gets
+ * a good answer */
+struct wl_breaker {
+    volatile apr_uint32_t   state;  /* WL_BREAKER_* */
+    volatile apr_uint32_t   until;  /* ms, end of the cooldown or probe deadline */
+    volatile apr_uint32_t  window;  /* s, start of the current window */
+    volatile apr_uint32_t   total;
+    volatile apr_uint32_t     bad;
+};
+
+/* in-flight table and DNS health, after the counters
+ * in the same segment. open addressing like the
+ * verdict table */
+struct wl_flights {
+    apr_uint32_t           nslots;
+    volatile apr_uint32_t  tokens;
+    volatile apr_uint32_t    busy;  /* verifications in DNS, server wide */
+    volatile apr_uint32_t  ranges;  /* bumped as the parent recompiles WLBotRanges */
+    struct wl_breaker     breaker;
+    struct wl_flight      slots[];
+};
+
+/* the verdict on a connection's client, reused by the
+ * later requests on it. the streams of an HTTP/2
+ * connection share the one of the master connection
+ * and may run in parallel threads, so it is a seqlock
+ * like a verdict slot and holds copies, not pool
+ * strings */
+struct wl_conn {
+    volatile apr_uint32_t     seq;
+    const void*               cfg;  /* per dir config it was reached with */
+    struct wl_addr         client;
+    int                    status;
+    apr_uint32_t           earned;  /* as in a verdict slot */
+    apr_time_t            expires;
+    char      mstatus[8];           /* MODWL_STATUS, "" for none */
+    char      reverse[WL_DNS_MAX_NAME];
+    char      forward[INET6_ADDRSTRLEN];
+};
+
+/* what WLBotRanges and WLBotDomains say about one bot.
+ * the parent compiles the ranges into an index the
+ * children map, and recompiles it when the file
+ * changes. a child swaps the trie whole and frees
+ * the old one once no reader can hold it */
+struct wl_bot_info {
+    const char*               bot;
+    const char*              path;  /* ranges file, NULL for none */
+    const char*             index;  /* compiled ranges in the runtime dir */
+    struct wl_trie* volatile trie;
+    apr_time_t              mtime;
+    apr_array_header_t*  suffixes;  /* WLBotDomains values */
+    struct wl_domains*    domains;
+    apr_uint32_t              tag;  /* names the suffixes in verdicts, 0 for none */
+    struct wl_bot_info*      next;
+};
+
+/* a WLList / WLBlacklist file, loaded once however
+ * many virtual hosts name it */
 struct wl_list {
-    struct wl_addr*          addr;
-    struct wl_list*          next; 
+    const char*              path;
+    apr_dev_t              device;
+    apr_ino_t               inode;  /* 0 when the file could not be stat'ed */
+    struct wl_trie           trie;
+    struct wl_bloom         bloom;  /* asked before the trie, empty for small lists */
+    int                    loaded;
+    struct wl_list*          next;
 };
 
-struct wl_bot_list {
-    char*                    name;
-    struct wl_bot_list*      next;
+/* what a virtual host checks addresses against,
+ * compiled at post_config and never changed after.
+ * hosts naming the same files share the lists */
+struct wl_policy {
+    const struct wl_list*    list;  /* WLList, NULL for none */
+    const struct wl_list*   blist;  /* WLBlacklist, NULL for none */
+};
+
+/* an address waiting to be appended to a list file */
+struct wl_pending {
+    const char*              path;
+    char     line[INET6_ADDRSTRLEN + 1];
+};
+
+/* per child queue of list appends drained by a
+ * background thread */
+struct wl_writer {
+    apr_thread_mutex_t*      lock;
+    apr_thread_cond_t*       wake;
+    apr_thread_t*          thread;
+    apr_pool_t*              pool;
+    server_rec*                 s;
+    struct wl_pending*      queue;
+    struct wl_pending*        out;
+    int                      size;
+    int                      head;
+    int                     count;
+    int                      stop;
+    int                  overflow;
+    int                     batch;
+    int                  interval;
+    int                     fsync;
+    apr_uint32_t           ranges;  /* WLBotRanges generation mapped */
+    struct wl_bot_list*      bots;  /* WLBotAutoAdd bots to publish, data is the config */
+    int                     nbots;
+};
+
+/* a verification handed to the background checkers.
+ * it owns the in-flight slot of its address */
+struct wl_check {
+    struct wl_addr         client;
+    void*                     cfg;  /* wl_config of the request */
+    const struct wl_bot_info*  info;  /* of the claimed bot, NULL for none */
+    struct wl_flight*      flight;
+    apr_uint32_t            token;
+    char   ip[INET6_ADDRSTRLEN];
+};
+
+/* per child queue of verifications run by a few
+ * background threads, WLVerifyMode Background */
+struct wl_checker {
+    apr_thread_mutex_t*      lock;
+    apr_thread_cond_t*       wake;
+    apr_thread_t* threads[WL_CHECKER_THREADS];
+    int                  nthreads;
+    server_rec*                 s;
+    struct wl_check*        queue;
+    int                      size;
+    int                      head;
+    int                     count;
+    int                      stop;
 };
 
 typedef struct       wl_addr addr;
-typedef struct       wl_list item;
+typedef struct       wl_trie trie;
 typedef struct wl_bot_list  bitem;
+typedef struct wl_matcher matcher;
 
-typedef struct {
+typedef struct wl_config {
     char             context[256];
     char*                     bot;
     char*                    list;
@@ -106,47 +491,87 @@ typedef struct {
     int                     debug;
     int                  lenabled;
     int                dnstimeout;
+    char*               dnsserver;
+    int                    nslots;
+    int                    ttl[4];
+    int             flushinterval;
+    int                flushbatch;
+    int                 flushsync;
+    int                    report;
     int			    spenv;
     int                listappend;
     int               blistappend;
-    bitem*                   cbot;
-    bitem*                  chead;
+    int             rangesrefresh;
+    int                 dnsmax[2];  /* in-flight verifications per child, server wide */
+    int               dnsfailopen;
+    int                breaker[3];  /* bad percent, cooldown seconds, slow ms */
+    int                verifymode;
+    int              verifybudget;  /* requests passed while verifying, 0 for any */
+    double             filterrate;  /* 0 for no list filters */
+    int                 filtermin;
+    char*                savefile;  /* WLCacheSnapshot, "" for none */
+    int              saveinterval;  /* seconds, 0 only saves on restart and stop */
+    int                       set;  /* WL_SET_* */
+    struct wl_bot_info*   botinfo;  /* WLBotRanges / WLBotDomains given here */
+    const struct wl_config* botbase;  /* nearest enclosing config giving any */
+    apr_hash_t*            botmap;  /* bot name to its nearest bot info */
+    int                botdomains;  /* bots in botmap with WLBotDomains */
+    struct wl_snapshot* volatile snap;
+    struct wl_config*        bots;  /* config holding the bots in use, this or the one inherited */
+    const struct wl_policy* policy;
 } wl_config;
 
 module AP_MODULE_DECLARE_DATA   
 wl_module;
 
 unsigned char                 wl_bytes[4];
-static wl_config*   	      wl_cfg;
 static int                    wl_init(request_rec* rec);
 static int                    wl_close(int status);
-static int                    wl_ip_addr_cmp(request_rec* rec, addr* reg_ip_addr, char* ip_addr);
-static void                   wl_create_addr(request_rec* rec, char* net, addr* c_addr);
+static int                    wl_verdict(request_rec* rec, const char* addr, int verdict, int* status);
+static int                    wl_pre_connection(conn_rec* c, void* csd);
+static struct wl_conn*        wl_conn_of(conn_rec* c);
+static int                    wl_conn_reuse(request_rec* rec, const wl_config* wl_cfg, const addr* client, int* status);
+static int                    wl_conn_keep(request_rec* rec, const wl_config* wl_cfg, const addr* client, int status, int ttl, apr_uint32_t earned);
 
 static int                    wl_can_append(wl_config* wl_cfg, int bt);
-static void                   wl_cleanup_list();
 static void                   wl_hooks(apr_pool_t* pool);
-static char*                  wl_forward_dns(char* addr);
-static char*                  wl_reverse_dns(char* addr);
-static void                   wl_append(request_rec* rec, char* ip_addr, int bl);
-static void                   wl_append_wl(request_rec* rec, char* ip_addr);
-static void                   wl_append_bl(request_rec* rec, char* ip_addr);
+static int                    wl_post_config(apr_pool_t* pconf, apr_pool_t* plog, apr_pool_t* ptemp, server_rec* s);
+static int                    wl_forward_dns(const char* name, const addr* client, char* out, size_t len, int timeout);
+static int                    wl_reverse_dns(const addr* client, char* name, size_t len, int timeout);
+static int                    wl_dns_verify(apr_pool_t* pool, int timeout, const addr* client, const struct wl_domains* domains, wl_dns_multi* dns);
+static int                    wl_dns_query(const char* qname, int qtype, int timeout, unsigned char* ans, int* anslen);
+static int                    wl_dns_add_server(const char* spec);
+static int                    wl_dns_parse_server(const char* spec, struct sockaddr_storage* ss, socklen_t* sslen);
 static void                   wl_fail(const char* what);
 static void*                  wl_xmalloc(size_t sz);
-static void 		              wl_reset(int bl);
-static int                    wl_in(request_rec* rec, char* addr, int bl);
-static void                   wl_load(char* fl, request_rec* rec, int bl);
-static void 		              wl_reset_bots();
-static void                   wl_load_bots(char* fl, request_rec* rec, wl_config* wl_cfg);
+static void*                  wl_xcalloc(size_t n, size_t sz);
+static int                    wl_in(const struct wl_list* l, const addr* client);
+static void                   wl_load(struct wl_list* l, server_rec* s);
+static struct wl_list*        wl_list_get(apr_pool_t* pconf, server_rec* s, const char* fl, const wl_config* main_cfg);
+static void                   wl_load_bots(char* fl, apr_pool_t* pool, server_rec* s, wl_config* wl_cfg);
+static void                   wl_preload(apr_pool_t* pconf, apr_pool_t* pool, server_rec* s);
+static void                   wl_report(server_rec* s, const char* what, const char* fl, const trie* t, wl_config* wl_cfg);
 static void                   wl_strip_ip(char *addr, char* strip);
 const char*                   apr_table_get(const apr_table_t* t, const char* key);
-static item*                  wl_element;
-static item*                  bl_element;
-inline static int             wl_in_agents(char* agent, wl_config* wl_cfg);
-inline static void            wl_append_bot(wl_config* wl_cfg, char* bot);
+inline static int             wl_in_agents(const char* agent, apr_pool_t* pool, wl_config* wl_cfg, const bitem** bot);
+static int                    wl_ranges_load(struct wl_bot_info* r, server_rec* s, apr_pool_t* pool);
+static void                   wl_ranges_attach(struct wl_bot_info* r, server_rec* s);
+static void                   wl_bots_link(wl_config* wl_cfg, server_rec* s, apr_pool_t* pconf, apr_pool_t* ptemp);
+static void                   wl_ranges_refresh(server_rec* s, apr_pool_t* pool);
+static void                   wl_ranges_follow(struct wl_writer* w);
+static int                    wl_ranges_in(const struct wl_bot_info* r, const addr* client);
+static bitem*                 wl_bot_new(const char* bot, int literal, bitem* next);
+static void                   wl_bots_free(bitem* bot);
+static int                    wl_bot_known(wl_config* wl_cfg, const char* name);
+static void                   wl_bots_auto(request_rec* rec, wl_config* wl_cfg, const char* agent);
+static void                   wl_bots_adopt(server_rec* s, apr_pool_t* pool, bitem* queued);
+static const char*            wl_bots_publish(apr_pool_t* pool, wl_config* wl_cfg, bitem* add);
+static apr_uint32_t           wl_rcu_enter(void);
+static void                   wl_rcu_leave(apr_uint32_t phase);
+static void                   wl_rcu_synchronize(void);
 inline static void*           wl_server_config(apr_pool_t* pool, server_rec* s);
 inline static void*           wl_dir_config(apr_pool_t* pool, char* context);
-inline static void            wl_append_list(wl_config* wl_cfg, char* fl, char* addr, request_rec* rec, int bt);
+inline static void            wl_append_list(wl_config* wl_cfg, char* fl, const char* addr, server_rec* s, apr_pool_t* pool, int bt);
 const char*                   wl_set_enabled(cmd_parms* cmd, void* cfg, const char* arg);
 const char*                   wl_set_list_enabled(cmd_parms* cmd, void* cfg, const char* arg);
 const char*                   wl_set_block_handler(cmd_parms* cmd, void* cfg, const char* arg);
@@ -157,13 +582,115 @@ const char*                   wl_set_blist(cmd_parms* cmd, void* cfg, const char
 const char*                   wl_set_blist_append(cmd_parms* cmd, void* cfg, const char* arg);
 const char*                   wl_set_bot_auto_add(cmd_parms* cmd, void* cfg, const char* arg);
 const char*                   wl_set_dns_timeout(cmd_parms* cmd, void* cfg, const char* arg);
-const char*		      wl_concat(char* ip1, char* ip2);
-static void                   wl_loaded(int bl);
-static int                    wl_wl_loaded = 0;
-static int                    wl_bl_loaded = 0;
-static int                    wl_bots_loaded = 0;
-static item*                  wl_head = NULL;
-static item*                  bl_head = NULL;
+const char*                   wl_set_dns_server(cmd_parms* cmd, void* cfg, const char* arg);
+static void                   wl_writer_start(apr_pool_t* pool, server_rec* s, wl_config* cfg);
+static void                   wl_checker_start(apr_pool_t* pool, server_rec* s);
+static int                    wl_checker_queue(request_rec* rec, wl_config* wl_cfg, const addr* client, const char* ip, const struct wl_bot_info* info, struct wl_flight* flight);
+static void                   wl_writer_write(apr_pool_t* pool, server_rec* s, const char* path, const char* buf, apr_size_t len, int sync);
+const char*                   wl_set_flush_interval(cmd_parms* cmd, void* cfg, const char* arg);
+const char*                   wl_set_flush_batch(cmd_parms* cmd, void* cfg, const char* arg);
+const char*                   wl_set_flush_sync(cmd_parms* cmd, void* cfg, const char* arg);
+static struct wl_writer       wl_writer;
+static struct wl_checker      wl_checker;
+static volatile apr_uint32_t  wl_rcu_phase = 0;
+static volatile apr_uint32_t  wl_rcu_readers[2];
+static apr_thread_mutex_t*    wl_rcu_lock = NULL;
+static apr_thread_mutex_t*    wl_rcu_grace = NULL;  /* one grace period at a time */
+static int                    wl_rcu_child = 0;  /* in a child, where publishing needs wl_rcu_lock */
+static volatile apr_uint32_t  wl_bots_added = 0;  /* by WLBotAutoAdd in this child */
+static void                   wl_child_init(apr_pool_t* pool, server_rec* s);
+static int                    wl_store_create(apr_pool_t* pconf, server_rec* s, int nslots, int nstats);
+static int                    wl_store_get(const addr* client, apr_uint32_t* earned);
+static void                   wl_store_put(const addr* client, int verdict, int ttl, apr_uint32_t earned);
+static void                   wl_store_save(apr_pool_t* pool, server_rec* s, const char* path);
+static void                   wl_sync_dir(apr_pool_t* pool, const char* path);
+static apr_uint32_t           wl_saved_sum(apr_uint32_t h, const void* data, apr_size_t len);
+static void                   wl_store_restore(apr_pool_t* pool, server_rec* s, const char* path, const int* ttl);
+static void                   wl_stats_locate(void);
+static apr_uint32_t           wl_flight_slots(int nstats);
+static struct wl_flight*      wl_flight_join(const addr* client, int timeout, int* leader);
+static int                    wl_flight_wait(struct wl_flight* f, const addr* client);
+static void                   wl_flight_release(struct wl_flight* f, apr_uint32_t token);
+static void                   wl_flight_leave(void);
+static int                    wl_dns_admit(server_rec* s, const wl_config* wl_cfg, int* probe);
+static void                   wl_dns_release(server_rec* s, const wl_config* wl_cfg, int probe, int status, apr_interval_time_t us);
+static struct wl_stat_slot*   wl_stat_slot(void);
+static inline void            wl_stat_inc(int what);
+static void                   wl_stat_dns(int which, int status, apr_interval_time_t us);
+static int                    wl_status_handler(request_rec* rec);
+const char*                   wl_set_cache_ttl(cmd_parms* cmd, void* cfg, const char* ok, const char* fail, const char* dnserr);
+const char*                   wl_set_shared_slots(cmd_parms* cmd, void* cfg, const char* arg);
+const char*                   wl_set_report(cmd_parms* cmd, void* cfg, const char* arg);
+const char*                   wl_set_bot_ranges(cmd_parms* cmd, void* cfg, const char* bot, const char* path);
+const char*                   wl_set_ranges_refresh(cmd_parms* cmd, void* cfg, const char* arg);
+const char*                   wl_set_bot_domains(cmd_parms* cmd, void* cfg, const char* bot, const char* suffix);
+const char*                   wl_set_dns_max(cmd_parms* cmd, void* cfg, const char* child, const char* server);
+const char*                   wl_set_dns_overload(cmd_parms* cmd, void* cfg, const char* arg);
+const char*                   wl_set_dns_breaker(cmd_parms* cmd, void* cfg, const char* bad, const char* cooldown, const char* slow);
+const char*                   wl_set_verify_mode(cmd_parms* cmd, void* cfg, const char* mode, const char* budget);
+const char*                   wl_set_cache_snapshot(cmd_parms* cmd, void* cfg, const char* path, const char* interval);
+static apr_shm_t*             wl_shm = NULL;
+static struct wl_store*       wl_store = NULL;
+static const char*            wl_shm_file = NULL;
+static const char*            wl_save_file = NULL;
+static apr_interval_time_t    wl_save_every = 0;
+static apr_time_t             wl_save_next = 0;
+static pid_t                  wl_save_pid = 0;  /* the parent, which saves */
+static apr_interval_time_t    wl_ranges_every = 0;
+static apr_time_t             wl_ranges_next = 0;
+static int                    wl_ranges_files = 0;  /* names the next compiled ranges */
+static int                    wl_domains_used = 0;  /* some host has WLBotDomains */
+static struct wl_stats*       wl_stats = NULL;
+static union wl_stat_line*    wl_stat_lines = NULL;
+static struct wl_flights*     wl_flights = NULL;
+static __thread struct wl_flight* wl_flight_mine = NULL;
+static __thread apr_uint32_t  wl_flight_token = 0;
+static volatile apr_uint32_t  wl_dns_busy = 0;
+static __thread int           wl_dns_counted = 0;  /* in wl_flights->busy */
+static __thread struct wl_stat_slot* wl_stat_mine = NULL;
+static __thread int           wl_stat_claimed = 0;
+static const char*            wl_stat_names[WL_STAT_MAX][2] = {
+    { "Requests", "requests" },
+    { "WhitelistHits", "whitelist_hits" },
+    { "BlacklistHits", "blacklist_hits" },
+    { "CachedPass", "cached_pass" },
+    { "CachedFail", "cached_fail" },
+    { "CachedDnsError", "cached_dns_error" },
+    { "AgentSkipped", "agent_skipped" },
+    { "DnsReverse", "dns_reverse" },
+    { "DnsForward", "dns_forward" },
+    { "DnsNotFound", "dns_not_found" },
+    { "DnsTimeout", "dns_timeout" },
+    { "DnsFailed", "dns_failed" },
+    { "VerifyPass", "verify_pass" },
+    { "VerifyFail", "verify_fail" },
+    { "BotsAdded", "bots_added" },
+    { "RangeHits", "range_hits" },
+    { "DomainRejects", "domain_rejects" },
+    { "Evictions", "evictions" },
+    { "Coalesced", "coalesced" },
+    { "CoalesceTimeouts", "coalesce_timeouts" },
+    { "ConnectionReused", "connection_reused" },
+    { "ShedBusy", "shed_busy" },
+    { "ShedBreaker", "shed_breaker" },
+    { "BreakerOpened", "breaker_opened" },
+    { "PendingPass", "pending_pass" },
+    { "ChecksQueued", "checks_queued" },
+    { "ChecksDropped", "checks_dropped" },
+    { "FilterRejects", "filter_rejects" },
+    { "FilterFalsePositives", "filter_false_positives" }
+};
+static const char*            wl_shed_names[] = { "", "child", "server", "breaker" };
+static const char*            wl_breaker_names[] = { "closed", "open", "half-open" };
+/* upper bounds of the DNS latency buckets in us, the last is open */
+static const apr_uint32_t     wl_stat_bounds[WL_STATS_BUCKETS - 1] = {
+    500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000
+};
+static struct wl_list*        wl_lists = NULL;  /* every list file of the configuration */
+static struct sockaddr_storage wl_dns_ns[WL_DNS_MAX_NS];
+static socklen_t              wl_dns_nslen[WL_DNS_MAX_NS];
+static int                    wl_dns_nns = 0;
+static const char*            wl_dns_status[] = { "ok", "not found", "timed out", "failed" };
 
 
 /**
@@ -177,6 +704,15 @@ static void wl_fail(const char* what)
     fprintf(stderr, "wl_module: system call failed: %s: %s", what, what);
 }
 
+#if WL_MODULE_COUNT_ALLOCS
+/* heap allocations made by this thread. the
+ * request path is meant to leave it unchanged */
+static __thread unsigned long wl_allocs = 0;
+#define WL_COUNT_ALLOC() (wl_allocs++)
+#else
+#define WL_COUNT_ALLOC()
+#endif
+
 /**
  * internal malloc
  * report any error that arose from
@@ -186,14 +722,35 @@ static void wl_fail(const char* what)
  */
 static void* wl_xmalloc(size_t sz)
 {
-    void* res = malloc(sz);
-    if (res) return res;
+    void* res;
+
+    WL_COUNT_ALLOC();
+    res = malloc(sz);
+    if (res == NULL)
+        wl_fail("malloc");
+
+    return res;
+}
+
+/**
+ * same as wl_xmalloc/1, zeroed
+ *
+ * @param n -> number of elements
+ * @param sz -> element size
+ */
+static void* wl_xcalloc(size_t n, size_t sz)
+{
+    void* res;
 
-    wl_fail((char*) "malloc");
+    WL_COUNT_ALLOC();
+    res = calloc(n, sz);
+    if (res == NULL)
+        wl_fail("calloc");
 
-    return (char*)"";
+    return res;
 }
 
+
 /**
  * this checks if we have enabled
  * adding to the lists automatically
@@ -203,692 +760,3658 @@ static void* wl_xmalloc(size_t sz)
  */
 static int wl_can_append(wl_config* wl_cfg, int bl)
 {
-  if (bl == 0 && wl_cfg->blistappend == 1){
-    return 1;
-  }
-  if (wl_cfg->listappend == 1) {
-    return 1;  
+  if (bl == 1) {
+    return wl_cfg->blistappend == 1;
   }
-  return 0;
+  return wl_cfg->listappend == 1;
 }
 
 /**
- * cleanup in memory lists
+ * parse a nameserver given as ip, ip:port
+ * or [ipv6]:port
+ *
+ * @param spec -> nameserver address
+ * @param ss -> parsed socket address
+ * @param sslen -> length of ss
  */
-static void wl_cleanup_list()
+static int wl_dns_parse_server(const char* spec, struct sockaddr_storage* ss, socklen_t* sslen)
 {
+    struct sockaddr_in* in4 = (struct sockaddr_in*) ss;
+    struct sockaddr_in6* in6 = (struct sockaddr_in6*) ss;
+    char host[INET6_ADDRSTRLEN + 1];
+    const char* port = NULL;
+    const char* end;
+    size_t len;
+    int num = WL_DNS_PORT;
+
+    if (spec[0] == '[') {
+        end = strchr(spec, ']');
+        if (end == NULL)
+            return -1;
+        spec++;
+        len = end - spec;
+        if (end[1] == ':')
+            port = end + 2;
+    } else {
+        end = strchr(spec, ':');
+        if (end != NULL && strchr(end + 1, ':') == NULL) {
+            len = end - spec;
+            port = end + 1;
+        } else {
+            len = strlen(spec);
+        }
+    }
+
+    if (len == 0 || len >= sizeof(host))
+        return -1;
+    memcpy(host, spec, len);
+    host[len] = '\0';
+
+    if (port != NULL) {
+        num = atoi(port);
+        if (num <= 0 || num > 65535)
+            return -1;
+    }
+
+    memset(ss, 0, sizeof(struct sockaddr_storage));
+
+    if (inet_pton(AF_INET, host, &in4->sin_addr) == 1) {
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons(num);
+        *sslen = sizeof(struct sockaddr_in);
+        return 0;
+    }
+    if (inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(num);
+        *sslen = sizeof(struct sockaddr_in6);
+        return 0;
+    }
 
+    return -1;
 }
 
 /**
- * reverse DNS a given address
- * 
- * @param addr -> IPv4 address
+ * add a nameserver to the resolver
+ *
+ * @param spec -> nameserver address
  */
-static char* wl_reverse_dns(char* addr)
+static int wl_dns_add_server(const char* spec)
 {
-    struct hostent* he;
-    struct in_addr ipv4addr;
-    
-    inet_pton(AF_INET, addr, &ipv4addr);
-    he = gethostbyaddr(&ipv4addr, sizeof(ipv4addr), AF_INET);
-    if ( he == NULL ) {
-      return NULL;
-    }
-    
-    return he->h_name;
+    if (wl_dns_nns >= WL_DNS_MAX_NS)
+        return -1;
+
+    if (wl_dns_parse_server(spec, &wl_dns_ns[wl_dns_nns], &wl_dns_nslen[wl_dns_nns]) != 0)
+        return -1;
+
+    wl_dns_nns++;
+    return 0;
 }
 
 /**
- * forward DNS a given address
- * 
- * @param addr -> IPv4 address
+ * install the nameservers given by WLDnsServer
+ * or else the ones from /etc/resolv.conf
+ *
+ * @param pool -> temporary pool
+ * @param s -> main server
+ * @param servers -> space separated WLDnsServer values
  */
-static char* wl_forward_dns(char* addr_a)
+static void wl_dns_load_servers(apr_pool_t* pool, server_rec* s, const char* servers)
 {
-    struct addrinfo hints, *res, *p;
-    int status;
-    char ipstr[INET6_ADDRSTRLEN];
-    struct in_addr* taddr = NULL;
-
-    memset(&hints, 0, sizeof(hints));    
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    
-    if ((status = getaddrinfo(addr_a, NULL, &hints, &res)) != 0) 
-        return addr_a;
+    apr_file_t* file;
+    char data[256];
+    char* spec;
+    char* last;
+    char* list;
 
-    p = res;
+    wl_dns_nns = 0;
 
-    while (p != NULL) {
-            if (p->ai_family == AF_INET) {
-                struct sockaddr_in* ipv4 = (struct sockaddr_in *) p->ai_addr;
-                taddr = &(ipv4->sin_addr);
-            }        
+    if (servers != NULL && servers[0] != '\0') {
+        list = apr_pstrdup(pool, servers);
+        for (spec = apr_strtok(list, " ", &last); spec; spec = apr_strtok(NULL, " ", &last))
+            wl_dns_add_server(spec);
+        return;
+    }
 
-            inet_ntop(p->ai_family, taddr, ipstr, sizeof(ipstr));
-            p = p->ai_next;
+    if (apr_file_open(&file, WL_DNS_RESOLV_CONF, APR_FOPEN_READ, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, "[" WL_MODULE_LOG_ID "] could not open %s", WL_DNS_RESOLV_CONF);
+        return;
     }
 
-    freeaddrinfo(res);
-    memmove(addr_a, ipstr, sizeof(ipstr));
+    while (apr_file_gets(data, sizeof(data), file) == APR_SUCCESS) {
+        if (strncmp(data, "nameserver", 10) != 0)
+            continue;
+        spec = apr_strtok(data + 10, " \t\r\n", &last);
+        if (spec != NULL && strchr(spec, '%') == NULL)
+            wl_dns_add_server(spec);
+    }
 
-    return addr_a;
+    apr_file_close(file);
 }
 
 /**
- * verify if the user agent is an agent
- * we need to evaluate
+ * encode a DNS question for qname / qtype
+ * returns the packet length or -1
  *
- * @param: agent -> HTTP Agent Tag
- * @param: wl_cfg -> module config
+ * @param buf -> packet buffer
+ * @param len -> buffer size
+ * @param id -> transaction id
+ * @param qname -> dotted name
+ * @param qtype -> record type
  */
-inline static int wl_in_agents(char* agent, wl_config* wl_cfg)
+static int wl_dns_build(unsigned char* buf, size_t len, uint16_t id, const char* qname, int qtype)
 {
-    regex_t rgx;
-    int rgx_state;
-    size_t found = 0;
-
-    if (wl_cfg->btany == 1)
-        return 1;
-
-    wl_strip_ip(agent, " ");
-
-    while (wl_cfg->cbot != NULL) {
-        rgx_state = regcomp(&rgx, wl_cfg->cbot->name, REG_EXTENDED);
-        
-        if (rgx_state)
-            wl_fail("ERR: WL couldn't compile agaisnt expression");
-
-        rgx_state = regexec(&rgx, agent, 0, NULL, 0);
-    
-        if (!rgx_state)
-            found = 1;
-
-        wl_cfg->cbot = wl_cfg->cbot->next;
+    const char* label = qname;
+    const char* dot;
+    size_t off = 12, n;
+
+    if (len < 12 + WL_DNS_MAX_NAME + 6)
+        return -1;
+
+    memset(buf, 0, 12);
+    buf[0] = id >> 8;
+    buf[1] = id & 0xFF;
+    buf[2] = 0x01;              /* RD */
+    buf[5] = 1;                 /* QDCOUNT */
+
+    while (*label) {
+        dot = strchr(label, '.');
+        n = dot ? (size_t) (dot - label) : strlen(label);
+        if (n == 0 || n > 63 || off + n + 1 > 12 + WL_DNS_MAX_NAME)
+            return -1;
+        buf[off++] = (unsigned char) n;
+        memcpy(buf + off, label, n);
+        off += n;
+        label += n;
+        if (*label == '.')
+            label++;
     }
-   
-    wl_cfg->cbot = wl_cfg->chead; 
 
-    return found;
+    buf[off++] = 0;
+    buf[off++] = 0;
+    buf[off++] = qtype;
+    buf[off++] = 0;
+    buf[off++] = 1;             /* IN */
+
+    return (int) off;
 }
 
 /**
- * point list to its head
- * @param bl is this the blacklist
+ * step over a (possibly compressed) name
+ * returns the offset after it or -1
  */
-static void wl_reset(int bl)
+static int wl_dns_skip_name(const unsigned char* msg, int len, int off)
 {
-    if (bl == 0) {
-      bl_element = bl_head; 
-      return;
+    while (off < len) {
+        if (msg[off] == 0)
+            return off + 1;
+        if ((msg[off] & 0xC0) == 0xC0)
+            return off + 2 <= len ? off + 2 : -1;
+        off += msg[off] + 1;
     }
-    wl_element = wl_head;
-}
 
-static void wl_append(request_rec* rec, char* ip_addr, int bl)
-{
-  if ( bl == 1 ) {
-    wl_append_bl( rec, ip_addr );
-    return;
-  }
-  wl_append_wl( rec, ip_addr );
+    return -1;
 }
-/** 
- * append to the whitelist
- * in memory
- *
- * @param rec -> apache request
- * @param ip_addr -> IPv4 address
+
+/**
+ * decode a (possibly compressed) name
+ * into dotted form
  */
-static void wl_append_wl(request_rec* rec, char* ip_addr)
+static int wl_dns_read_name(const unsigned char* msg, int len, int off, char* out, size_t outlen)
 {
-    wl_element = (item*) wl_xmalloc(sizeof(item));
-    wl_element->addr = (addr*) malloc( sizeof( addr ) );
-    wl_create_addr( rec, ip_addr, wl_element->addr);
-    wl_element->next = wl_head;
-    wl_head = wl_element;
-    AP_LOG_INFO(rec, "wl_append_wl address added is %s, bits %d", wl_element->addr->addr, wl_element->addr->bits);
+    size_t pos = 0;
+    int jumps = 0;
+    unsigned int n;
+
+    while (off < len) {
+        n = msg[off];
+        if (n == 0) {
+            if (pos == 0)
+                out[pos++] = '.';
+            else
+                pos--;          /* trailing dot */
+            out[pos] = '\0';
+            return 0;
+        }
+        if ((n & 0xC0) == 0xC0) {
+            if (off + 1 >= len || ++jumps > 16)
+                return -1;
+            off = ((n & 0x3F) << 8) | msg[off + 1];
+            continue;
+        }
+        if (off + 1 + (int) n > len || pos + n + 2 > outlen)
+            return -1;
+        memcpy(out + pos, msg + off + 1, n);
+        pos += n;
+        out[pos++] = '.';
+        off += n + 1;
+    }
+
+    return -1;
 }
 
 /**
- * same as wl_append_wl/1
- * for blacklists
+ * send one question to every configured nameserver
+ * and wait for the first usable answer. sockets are
+ * non-blocking and the wait never passes the deadline,
+ * a single retransmit goes out at half time
  *
- * @param rec -> apache request
- * @param ip_addr -> IPv4 address
+ * @param qname -> dotted name
+ * @param qtype -> record type
+ * @param timeout -> deadline in milliseconds
+ * @param ans -> answer buffer (WL_DNS_MAX_PACKET)
+ * @param anslen -> answer length
  */
-static void wl_append_bl(request_rec* rec, char* ip_addr)
+static int wl_dns_query(const char* qname, int qtype, int timeout, unsigned char* ans, int* anslen)
 {
-    bl_element = (item*) wl_xmalloc(sizeof(item));
-    wl_create_addr( rec, ip_addr, bl_element->addr);
-    bl_element->next = bl_head;
-    bl_head = bl_element;
-}
+    unsigned char q[12 + WL_DNS_MAX_NAME + 6];
+    struct pollfd pfd[WL_DNS_MAX_NS];
+    apr_time_t now, deadline, resend;
+    int qlen, i, n, r, wait, nfds = 0, failed = 0, resent = 0;
+    int status = WL_DNS_TIMEOUT;
+    uint16_t id;
+
+    if (wl_dns_nns == 0)
+        return WL_DNS_ERROR;
+
+    /* the id and the kernel's random source port are
+     * all that keeps a spoofed reply from being taken */
+    if (apr_generate_random_bytes((unsigned char*) &id, sizeof(id)) != APR_SUCCESS)
+        return WL_DNS_ERROR;
+
+    now = apr_time_now();
+    qlen = wl_dns_build(q, sizeof(q), id, qname, qtype);
+    if (qlen < 0)
+        return WL_DNS_ERROR;
+
+    for (i = 0; i < wl_dns_nns; i++) {
+        pfd[nfds].fd = socket(wl_dns_ns[i].ss_family, SOCK_DGRAM, 0);
+        if (pfd[nfds].fd < 0)
+            continue;
+        fcntl(pfd[nfds].fd, F_SETFL, fcntl(pfd[nfds].fd, F_GETFL) | O_NONBLOCK);
+        fcntl(pfd[nfds].fd, F_SETFD, FD_CLOEXEC);
+        if (connect(pfd[nfds].fd, (struct sockaddr*) &wl_dns_ns[i], wl_dns_nslen[i]) != 0
+            || send(pfd[nfds].fd, q, qlen, 0) != qlen) {
+            close(pfd[nfds].fd);
+            continue;
+        }
+        pfd[nfds].events = POLLIN;
+        nfds++;
+    }
 
-void wl_create_addr(request_rec* rec, char* net, addr* c_addr)
-{
-  char* token;
-  c_addr->addr = NULL;
-  c_addr->bits = 32;
-  c_addr->cidr = -1;
-  token = strsep(&net, "/");
+    if (nfds == 0)
+        return WL_DNS_ERROR;
 
-  while (token) {
-    if ( c_addr->addr == NULL ) {
-      c_addr->addr =(const char*) strdup(token);
-    } else {
-      c_addr->bits = atoi( token );
-      c_addr->cidr = 0;
+    deadline = now + apr_time_from_msec(timeout);
+    resend = now + apr_time_from_msec(timeout) / 2;
+
+    while (status == WL_DNS_TIMEOUT && failed < nfds) {
+        now = apr_time_now();
+        if (now >= deadline)
+            break;
+        if (!resent && now >= resend) {
+            for (i = 0; i < nfds; i++) {
+                if (pfd[i].fd >= 0)
+                    send(pfd[i].fd, q, qlen, 0);
+            }
+            resent = 1;
+        }
+
+        wait = (int) apr_time_as_msec((resent ? deadline : resend) - now) + 1;
+        n = poll(pfd, nfds, wait);
+        if (n < 0 && errno != EINTR) {
+            status = WL_DNS_ERROR;
+            break;
+        }
+
+        for (i = 0; n > 0 && i < nfds; i++) {
+            if (pfd[i].fd < 0 || !(pfd[i].revents & (POLLIN | POLLERR)))
+                continue;
+
+            r = recv(pfd[i].fd, ans, WL_DNS_MAX_PACKET, 0);
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+
+            /* refused / unreachable server or a reply to
+             * some other question: stop listening to it */
+            if (r < qlen || ans[0] != q[0] || ans[1] != q[1] || !(ans[2] & 0x80)
+                || memcmp(ans + 12, q + 12, qlen - 12) != 0) {
+                if (r < 0) {
+                    close(pfd[i].fd);
+                    pfd[i].fd = -1;
+                    failed++;
+                }
+                continue;
+            }
+
+            /* truncated: the answers that did not fit are
+             * only sent over TCP, don't judge by the rest */
+            if (ans[2] & 0x02) {
+                status = WL_DNS_ERROR;
+                break;
+            }
+
+            switch (ans[3] & 0x0F) {
+            case 0:
+                *anslen = r;
+                status = WL_DNS_OK;
+                break;
+            case 3:
+                status = WL_DNS_NOTFOUND;
+                break;
+            default:
+                close(pfd[i].fd);
+                pfd[i].fd = -1;
+                failed++;
+            }
+            if (status != WL_DNS_TIMEOUT)
+                break;
+        }
     }
-    token = strsep(&net, "/");
-  }
-  AP_LOG_INFO(rec, "wl_create_addr created address %s with bits %d and cidr is %d", c_addr->addr, c_addr->bits, c_addr->cidr);
+
+    if (status == WL_DNS_TIMEOUT && failed == nfds)
+        status = WL_DNS_ERROR;
+
+    for (i = 0; i < nfds; i++) {
+        if (pfd[i].fd >= 0)
+            close(pfd[i].fd);
+    }
+
+    return status;
 }
 
 /**
- * compare an IP address including a mask
- * 
- * @param rec -> apache request
- * @param reg_ip_addr -> bot registered address
- * @param ip_addr -> IPv4 address
+ * walk the answer section calling back for
+ * every record of the asked type
  */
-static int wl_ip_addr_cmp(request_rec* rec, addr* reg_ip_addr, char* ip_addr)
+static int wl_dns_answers(const unsigned char* msg, int len, int qtype,
+                          int (*cb)(const unsigned char* msg, int len, int off, int rdlen, void* baton),
+                          void* baton)
 {
-  struct in_addr ip;
-  struct in_addr net;
-  addr* c_addr = (addr*) malloc(sizeof(addr));
-  AP_LOG_INFO(rec, "wl_ip_addr_cmp called");
+    int off, i, type, rdlen;
+    int an = (msg[6] << 8) | msg[7];
+
+    off = wl_dns_skip_name(msg, len, 12);
+    if (off < 0 || off + 4 > len)
+        return WL_DNS_ERROR;
+    off += 4;
+
+    for (i = 0; i < an; i++) {
+        off = wl_dns_skip_name(msg, len, off);
+        if (off < 0 || off + 10 > len)
+            return WL_DNS_ERROR;
+        type = (msg[off] << 8) | msg[off + 1];
+        rdlen = (msg[off + 8] << 8) | msg[off + 9];
+        off += 10;
+        if (off + rdlen > len)
+            return WL_DNS_ERROR;
+        if (type == qtype && cb(msg, len, off, rdlen, baton) == 0)
+            return WL_DNS_OK;
+        off += rdlen;
+    }
 
-  wl_create_addr(rec, ip_addr, c_addr);
-  inet_aton(reg_ip_addr->addr, &ip);
-  inet_aton(ip_addr, &net);
+    return WL_DNS_NOTFOUND;
+}
 
-  if (c_addr->bits == 0) {
-    // C99 6.5.7 (3): u32 << 32 is undefined behaviour
-    AP_LOG_INFO(rec, "wl_ip_addr_cmp bits are 0. no need to compare..");
-    return 0;
-  }
+struct wl_dns_name {
+    char*                    name;
+    size_t                    len;
+};
 
-  inet_aton(reg_ip_addr->addr, &ip);
-  inet_aton(ip_addr, &net);
-  AP_LOG_INFO(rec, "wl_ip_addr_cmp comparing registered %s/%d with %s", reg_ip_addr->addr, reg_ip_addr->bits, ip_addr);
+static int wl_dns_ptr_cb(const unsigned char* msg, int len, int off, int rdlen, void* baton)
+{
+    struct wl_dns_name* n = baton;
+
+    /* the name is all of the RDATA, its labels up to a
+     * compression pointer may not run into the next record */
+    if (wl_dns_skip_name(msg, off + rdlen, off) != off + rdlen)
+        return -1;
 
-  return !((ip.s_addr ^ net.s_addr) & htonl(0xFFFFFFFFu << (32 - reg_ip_addr->bits)));
+    return wl_dns_read_name(msg, len, off, n->name, n->len);
 }
 
-static void wl_loaded(int bl)
+struct wl_dns_fwd {
+    const addr*            client;
+    int                     found;
+    char*                     out;
+    size_t                    len;
+};
+
+static int wl_dns_a_cb(const unsigned char* msg, int len, int off, int rdlen, void* baton)
 {
-  if (bl == 1) {
-    wl_bl_loaded = 1;
-    return;
-  }
-  wl_wl_loaded = 1;
+    struct wl_dns_fwd* f = baton;
+    const unsigned char* p = msg + off;
+    addr a;
+    int i, same;
+
+    if (rdlen == 4) {
+        a.net[0] = a.net[1] = 0;
+        a.net[2] = 0xFFFF;
+        a.net[3] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+    } else if (rdlen == 16) {
+        for (i = 0; i < 4; i++)
+            a.net[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16
+                     | (uint32_t) p[4 * i + 2] << 8 | p[4 * i + 3];
+    } else {
+        return -1;
+    }
+
+    same = wl_addr_same(&a, f->client);
+    if (!f->found || same) {
+        inet_ntop(rdlen == 4 ? AF_INET : AF_INET6, p, f->out, f->len);
+        f->found = 1;
+    }
+
+    return same ? 0 : -1;
 }
+
 /**
- * Load the specified 
- * List file into
- * memory
- * @param fl -> whitelist file (loaded in config)
- * @param rec -> apache request structure
- * @param bl -> is this the blacklist
+ * reverse DNS a given address, under in-addr.arpa
+ * for IPv4 and ip6.arpa nibbles for IPv6
+ * 
+ * @param client -> client address
+ * @param name -> PTR name
+ * @param len -> size of name
+ * @param timeout -> deadline in milliseconds
  */
-static void wl_load(char* fl, request_rec* rec, int bl)
+static int wl_reverse_dns(const addr* client, char* name, size_t len, int timeout)
 {
-    apr_file_t* file;
-    apr_status_t wl_st;
-    apr_size_t datalen = 256;
-    char data[256]; 
-    char *pos;
-
-    wl_st = apr_file_open(&file,
-                          fl,
-                          APR_FOPEN_CREATE | APR_FOPEN_READ,
-                          APR_OS_DEFAULT,
-                          rec->pool);
-    if (wl_st != APR_SUCCESS) {
-        AP_LOG_INFO(rec, "could not open file: %s", fl);
-        return;
-    }
-
-    while (apr_file_gets(data, datalen, file) == APR_SUCCESS) {
-        if ((pos=strchr(data, '\n')) == NULL) {
-            AP_LOG_ERR(rec, "could not process %s file because input buffer was too long", fl);
-            wl_cleanup_list();
-            return;
+    static const char hex[] = "0123456789abcdef";
+    unsigned char ans[WL_DNS_MAX_PACKET];
+    char qname[80];
+    char* q = qname;
+    struct wl_dns_name n = { name, len };
+    int anslen, status, w, sh;
+
+    if (wl_addr_is_v4(client)) {
+        snprintf(qname, sizeof(qname), "%u.%u.%u.%u.in-addr.arpa",
+                 client->net[3] & 0xFF, (client->net[3] >> 8) & 0xFF,
+                 (client->net[3] >> 16) & 0xFF, client->net[3] >> 24);
+    } else {
+        for (w = 3; w >= 0; w--) {
+            for (sh = 0; sh < 32; sh += 4) {
+                *q++ = hex[(client->net[w] >> sh) & 0xF];
+                *q++ = '.';
+            }
         }
-        *pos = '\0';
-
-        AP_LOG_INFO(rec, "wl_load_wl adding address %s into list", data);
-        wl_append(rec, data, bl);
+        strcpy(q, "ip6.arpa");
     }
 
-    wl_st = apr_file_close(file);
-    if (wl_st != APR_SUCCESS) {
-        AP_LOG_INFO(rec, "could not close file %s", fl);
-        wl_cleanup_list();
-        return;
-    }
+    status = wl_dns_query(qname, WL_DNS_T_PTR, timeout, ans, &anslen);
+    if (status != WL_DNS_OK)
+        return status;
 
-    wl_loaded( bl );
+    return wl_dns_answers(ans, anslen, WL_DNS_T_PTR, wl_dns_ptr_cb, &n);
 }
 
 /**
- * check if this IP is already  
- * whitelisted
+ * forward DNS a given name. out receives the
+ * client address when the name resolves to it,
+ * otherwise the first address found
  * 
- * @param rec -> apache request
- * @param -> IPv4 address
- * @param bl -> is this the blacklist
+ * @param name -> host name
+ * @param client -> address to look for, A or AAAA by its family
+ * @param out -> resolved address
+ * @param len -> size of out
+ * @param timeout -> deadline in milliseconds
  */
-static int wl_in(request_rec* rec, char* addr, int bl)
+static int wl_forward_dns(const char* name, const addr* client, char* out, size_t len, int timeout)
 {
-  item* element = wl_element;
-  if ( bl == 1 ) {
-    element = bl_element;
-  }
+    unsigned char ans[WL_DNS_MAX_PACKET];
+    struct wl_dns_fwd f = { client, 0, out, len };
+    int qtype = wl_addr_is_v4(client) ? WL_DNS_T_A : WL_DNS_T_AAAA;
+    int anslen, status;
 
-  while (element) {
-      if (wl_ip_addr_cmp(rec, element->addr, addr) == 1) {
-          wl_reset(bl);
-          return 1;
-      }
+    status = wl_dns_query(name, qtype, timeout, ans, &anslen);
+    if (status != WL_DNS_OK)
+        return status;
 
-      element = element->next;
-  }
-  wl_reset(bl);
-  return 0;
+    status = wl_dns_answers(ans, anslen, qtype, wl_dns_a_cb, &f);
+    if (status == WL_DNS_NOTFOUND && f.found)
+        return WL_DNS_OK;
+
+    return status;
 }
-    
 
 /**
- * append a new bot to
- * WL's configuration.
+ * per lookup deadline configured by WLDnsTimeout
  *
  * @param wl_cfg -> module config
- * @param bot -> user agent substring (for bot). i.e: Yandex/2.1
  */
-inline static void wl_append_bot(wl_config* wl_cfg, char* bot)
+static int wl_dns_timeout(const wl_config* wl_cfg)
 {
-    wl_cfg->cbot = (bitem*) wl_xmalloc(sizeof(bitem));
-    wl_cfg->cbot->name = bot;
-    wl_cfg->cbot->next = wl_cfg->chead;
-    wl_cfg->chead = wl_cfg->cbot;
+    return wl_cfg->dnstimeout > 0 ? wl_cfg->dnstimeout : WL_DNS_RESOLV_TIMEOUT;
 }
 
 /**
- * gets rid of any extra characters this ip addr
- * may have.
+ * reverse then forward resolve an address. every
+ * lookup is bounded by the timeout and the results
+ * are copied into the given pool
  *
- * @param addr -> IPv4 address
- * @param strip -> character delimiter
+ * @param pool -> pool receiving the names
+ * @param timeout -> per lookup deadline in milliseconds
+ * @param client -> client address
+ * @param domains -> suffixes the PTR name must end in, NULL for any
+ * @param dns -> reverse / forward results
  */
-static void wl_strip_ip(char *addr, char* strip)
+static int wl_dns_verify(apr_pool_t* pool, int timeout, const addr* client, const struct wl_domains* domains, wl_dns_multi* dns)
 {
-    char *p, *q;
+    char name[WL_DNS_MAX_NAME];
+    char fwd[INET6_ADDRSTRLEN];
+    apr_time_t start;
+    int status;
 
-    for (q = p = addr; *p; p++)
-        if (*p != *strip)
-            *q++ = *p;
+    dns->wl_dns_reverse = NULL;
+    dns->wl_dns_forward = "";
+
+    start = apr_time_now();
+    status = wl_reverse_dns(client, name, sizeof(name), timeout);
+    wl_stat_dns(WL_STAT_REVERSE, status, apr_time_now() - start);
+    if (status != WL_DNS_OK)
+        return status;
+    dns->wl_dns_reverse = apr_pstrdup(pool, name);
+
+    /* a name outside the bot's domains fails without
+     * its forward lookup, like a forward mismatch */
+    if (domains != NULL && !wl_domains_match(domains, name)) {
+        wl_stat_inc(WL_STAT_DOMAIN_REJECTS);
+        return WL_DNS_OK;
+    }
 
-    *q = '\0';
+    start = apr_time_now();
+    status = wl_forward_dns(name, client, fwd, sizeof(fwd), timeout);
+    wl_stat_dns(WL_STAT_FORWARD, status, apr_time_now() - start);
+    if (status == WL_DNS_OK)
+        dns->wl_dns_forward = apr_pstrdup(pool, fwd);
+
+    /* a name that doesn't resolve simply fails verification */
+    return status == WL_DNS_NOTFOUND ? WL_DNS_OK : status;
 }
 
-/** 
- * concatenate two ip strings
- * 
- * @param ip1 -> IPv4 address
- * @param ip2 -> IPv4 address
+/**
+ * verify if the user agent is an agent
+ * we need to evaluate. the literals are matched in
+ * a single pass over the header, spaces are skipped
+ * the same way they are stripped from WLBot values.
+ * with no bots configured every agent is evaluated
+ *
+ * @param: agent -> HTTP Agent Tag, not modified
+ * @param: pool -> request pool, for the regex copy
+ * @param: wl_cfg -> module config
+ * @param: bot -> the bot matched, NULL if any agent is evaluated
  */
-const char* wl_concat(char* ip1, char* ip2)
+inline static int wl_in_agents(const char* agent, apr_pool_t* pool, wl_config* wl_cfg, const bitem** bot)
 {
-    char *result = malloc(strlen(ip1)+strlen(ip2)+1); //+1 for the zero-terminator
-    strcpy(result, ip1);
-    strcat(result, ip2);
+    const struct wl_snapshot* snap;
+    const matcher* m;
+    char* copy;
+    apr_uint32_t phase;
+    int found = 0;
+
+    /* bot items are never freed, the match outlives the snapshot */
+    *bot = NULL;
+
+    if (wl_cfg->btany == 1)
+        return 1;
+
+    phase = wl_rcu_enter();
+    snap = wl_cfg->snap;
+    m = snap != NULL ? snap->matcher : NULL;
+
+    if (m == NULL || snap->bots == NULL) {
+        found = 1;
+        goto done;
+    }
+
+    *bot = wl_matcher_scan(m, agent);
+    if (*bot != NULL || m->nrgx == 0)
+        goto found;
+
+    copy = apr_pstrdup(pool, agent);
+    wl_strip_ip(copy, " ");
+    *bot = wl_matcher_regex(m, copy);
+
+found:
+    found = *bot != NULL;
 
-    return result;
+done:
+    wl_rcu_leave(phase);
+    return found;
 }
 
 /**
- * point the bot list to 
- * head
+ * readers enter the current phase before loading a
+ * snapshot pointer and leave once done with it
  */
-static void wl_reset_bots()
+static apr_uint32_t wl_rcu_enter(void)
+{
+    apr_uint32_t phase = apr_atomic_read32(&wl_rcu_phase) & 1;
+
+    apr_atomic_inc32(&wl_rcu_readers[phase]);
+    return phase;
+}
+
+static void wl_rcu_leave(apr_uint32_t phase)
 {
-    wl_cfg->cbot = wl_cfg->chead;
+    apr_atomic_dec32(&wl_rcu_readers[phase]);
 }
 
 /**
- * load a list of user agents
- *
- * @param fl -> path to file
- * @param rec -> Apache 2 request
+ * wait until no reader can still hold a snapshot
+ * that was swapped out before this call. the phase
+ * flips twice: a reader that saw the old phase but
+ * counted itself late loads the new pointer, one
+ * that counted itself in time is waited for. the
+ * two flips must be this caller's, so grace periods
+ * take their own lock, not the one of the writers
  */
-static void wl_load_bots(char* fl, request_rec* rec, wl_config* wl_cfg)
+static void wl_rcu_synchronize(void)
 {
-    apr_file_t* wl_file;
-    apr_status_t wl_st;
-    apr_size_t datalen = 256;
-    char* data = ""; 
-    char* bot;
-
-    wl_st = apr_file_open(&wl_file, fl, APR_FOPEN_CREATE | APR_FOPEN_READ, 0, rec->pool);
-
-    // Can't use file..
-    if (!(wl_st == APR_SUCCESS))
-	return;
-
-    while (apr_file_gets(data, datalen, wl_file) == APR_SUCCESS) {
-        if (!strcasecmp(data, ""))
-            continue;
-
-        wl_strip_ip(data, " ");
-        wl_strip_ip(data, "\n");
+    apr_uint32_t old;
+    int i;
 
-        bot = wl_xmalloc(sizeof(char) * 256);
-
-        strcpy(bot, data);
-        wl_append_bot(wl_cfg, bot);
+#if APR_HAS_THREADS
+    if (wl_rcu_grace != NULL)
+        apr_thread_mutex_lock(wl_rcu_grace);
+#endif
+    for (i = 0; i < 2; i++) {
+        old = apr_atomic_inc32(&wl_rcu_phase) & 1;
+        while (apr_atomic_read32(&wl_rcu_readers[old]) != 0) {
+#if APR_HAS_THREADS
+            apr_thread_yield();
+#endif
+        }
     }
-
-    wl_st = apr_file_close(wl_file);
-    wl_bots_loaded = 1;
+#if APR_HAS_THREADS
+    if (wl_rcu_grace != NULL)
+        apr_thread_mutex_unlock(wl_rcu_grace);
+#endif
 }
 
 /**
- * checks whether an incoming request
- * needs to be blocked
- * 
- * @param rec -> Apache 2 request
+ * add bots and publish a new snapshot. the new
+ * items are linked in front of the current ones,
+ * which never change, and the old matcher is freed
+ * once no reader can see it
+ *
+ * @param pool -> pool for the error message
+ * @param wl_cfg -> module config
+ * @param add -> bots to add, linked through next
  */
-static int wl_init(request_rec* rec)
+static const char* wl_bots_publish(apr_pool_t* pool, wl_config* wl_cfg, bitem* add)
 {
-    char* addr;
-    char* initial;
-    char* agent;
-    AP_LOG_INFO(rec, "wl_init called");
-    wl_config* wl_cfg = (wl_config*) ap_get_module_config(rec->per_dir_config, &wl_module);
-        
-    if (wl_cfg->spenv == 1) {
-	    apr_table_set(rec->subprocess_env, "MODWL_BOTS", wl_cfg->bot);
-    }
+    struct wl_snapshot* old;
+    struct wl_snapshot* snap;
+    bitem* tail;
+    const char* badre = NULL;
+    const char* err = NULL;
+
+#if APR_HAS_THREADS
+    /* the parent has no other threads to race with */
+    if (wl_rcu_child && wl_rcu_lock == NULL)
+        return "WL has no bot snapshot lock, not adding bots";
+    if (wl_rcu_lock != NULL)
+        apr_thread_mutex_lock(wl_rcu_lock);
+#endif
 
-    if (wl_cfg->enabled != 1) {
-        return (OK);
+    old = wl_cfg->snap;
+
+    snap = wl_xcalloc(1, sizeof(struct wl_snapshot));
+    if (snap == NULL) {
+        err = "WL could not allocate the bot matcher";
+        goto out;
     }
 
-    if (strcasecmp(wl_cfg->btlist, "") && wl_bots_loaded != 1) {
-        AP_LOG_INFO(rec, "loading bot list into memory");
-        wl_load_bots(wl_cfg->btlist, rec, wl_cfg);
+    snap->bots = old != NULL ? old->bots : NULL;
+    if (add != NULL) {
+        for (tail = add; tail->next != NULL; tail = tail->next)
+            ;
+        tail->next = snap->bots;
+        snap->bots = add;
     }
 
-    if (strcasecmp(wl_cfg->list, "") && wl_wl_loaded != 1) {
-        AP_LOG_INFO(rec, "loading white list into memory");
-        wl_load(wl_cfg->list, rec, 0);
+    switch (wl_matcher_build(snap->bots, &snap->matcher, &badre)) {
+    case WL_MATCHER_NOMEM:
+        err = "WL could not allocate the bot matcher";
+        break;
+    case WL_MATCHER_BADRE:
+        err = apr_psprintf(pool, "WL couldn't compile bot expression: %s", badre);
+        break;
     }
 
-    if (strcasecmp(wl_cfg->blist, "") && wl_bl_loaded != 1) {
-        AP_LOG_INFO(rec, "loading black list into memory");
-        wl_load(wl_cfg->blist, rec, 1);
+    if (err != NULL) {
+        if (add != NULL)
+            tail->next = NULL;
+        free(snap);
+        goto out;
     }
 
+    apr_atomic_xchgptr((volatile void**) &wl_cfg->snap, snap);
 
-#if AP_SERVER_MAJORVERSION_NUMBER >= 2 && AP_SERVER_MINORVERSION_NUMBER >= 4
-    addr = initial = rec->connection->client_ip;
-#else
-    addr = initial = rec->connection->remote_ip;
+out:
+#if APR_HAS_THREADS
+    if (wl_rcu_lock != NULL)
+        apr_thread_mutex_unlock(wl_rcu_lock);
 #endif
 
-    if (wl_cfg->spenv == 1) {
-	apr_table_set(rec->subprocess_env, "MODWL_ORIGINAL", addr);
+    /* the next writer need not wait for the readers */
+    if (err == NULL && old != NULL) {
+        wl_rcu_synchronize();
+        wl_matcher_free(old->matcher);
+        free(old);
     }
 
-    if ( wl_wl_loaded == 1 && wl_in(rec, addr, 0)  == 1) {
-      AP_LOG_INFO(rec, "Found address: %s in whitelist. will not reverse/forward DNS", addr);
-      return (OK);
+    return err;
+}
+
+/**
+ * free the bot snapshot of a config, its matcher
+ * and bot items, with the configuration pool. the
+ * next generation publishes its own
+ *
+ * @param data -> module config
+ */
+static apr_status_t wl_snapshot_cleanup(void* data)
+{
+    wl_config* wl_cfg = data;
+    struct wl_snapshot* snap = wl_cfg->snap;
+
+    if (snap == NULL)
+        return APR_SUCCESS;
+
+    wl_cfg->snap = NULL;
+    wl_matcher_free(snap->matcher);
+    wl_bots_free(snap->bots);
+    free(snap);
+
+    return APR_SUCCESS;
+}
+
+/**
+ * free bot items and their names
+ *
+ * @param bot -> first item, linked through next
+ */
+static void wl_bots_free(bitem* bot)
+{
+    bitem* next;
+
+    for (; bot != NULL; bot = next) {
+        next = bot->next;
+        free(bot->name);
+        free(bot);
     }
+}
 
-    if ( wl_bl_loaded == 1 && wl_in(rec, addr, 1)  == 1) {
-      AP_LOG_INFO(rec, "Found address: %s in blacklist. rejecting request", addr);
-      return (DECLINED);
+/**
+ * log a list line that is not an address
+ *
+ * @param baton -> server the list belongs to
+ * @param path -> list file
+ * @param lineno -> line number
+ * @param line -> offending line
+ */
+static void wl_load_badline(void* baton, const char* path, unsigned long lineno, const char* line)
+{
+    AP_SLOG_DEBUG((server_rec*) baton, "%s:%lu: ignoring invalid address %s", path, lineno, line);
+}
+
+/**
+ * Load the specified 
+ * List file into
+ * memory. a binary index built by
+ * wl_compile is mapped instead of parsed
+ * @param l -> list and its file (loaded in config)
+ * @param s -> server the list belongs to
+ */
+static void wl_load(struct wl_list* l, server_rec* s)
+{
+    trie* t = &l->trie;
+    const char* fl = l->path;
+    unsigned long bad;
+
+    switch (wl_trie_map(t, fl)) {
+    case WL_INDEX_OK:
+        AP_SLOG_INFO(s, "mapped list index %s with %u entries", fl, t->entries);
+        l->loaded = 1;
+        return;
+    case WL_INDEX_BAD:
+        AP_SLOG_ERR(s, "list index %s is damaged or from another version. rebuild it with wl_compile", fl);
+        return;
+    }
+
+    switch (wl_trie_read(t, fl, wl_load_badline, s, &bad)) {
+    case WL_INDEX_OK:
+        break;
+    case WL_INDEX_NOMEM:
+        AP_SLOG_ERR(s, "could not grow list for %s", fl);
+        wl_trie_free(t);
+        return;
+    default:
+        AP_SLOG_INFO(s, "could not read file: %s", fl);
+        wl_trie_free(t);
+        return;
     }
 
+    if (bad > 0)
+        AP_SLOG_WARN(s, "ignored %lu invalid entries in %s", bad, fl);
 
-#if WL_MODULE_DEBUG_MODE
-    AP_LOG_INFO(rec, "Original remote ip is: %s", addr);
+    /* nothing is added after loading except
+     * appends, so give back the growth slack */
+    wl_trie_compact(t);
+    l->loaded = 1;
+}
+
+/**
+ * free a list with the configuration
+ *
+ * @param data -> list
+ */
+static apr_status_t wl_list_cleanup(void* data)
+{
+    struct wl_list* l = data;
 
-    while (wl_cfg->cbot != NULL) {
-        AP_LOG_INFO(rec, "Initialized bot: %s", wl_cfg->cbot->name);
-	
-        wl_cfg->cbot = wl_cfg->cbot->next;
+    wl_bloom_free(&l->bloom);
+    wl_trie_free(&l->trie);
+    l->loaded = 0;
+
+    return APR_SUCCESS;
+}
+
+/**
+ * the list of a file, loaded on first use. a file
+ * named by several virtual hosts, under the same
+ * path or through a link, is read once and shared.
+ * a large list gets a filter so most addresses
+ * outside it are turned away without the trie
+ *
+ * @param pconf -> configuration pool, frees it on restart
+ * @param s -> server naming the file
+ * @param fl -> list file, "" for none
+ * @param main_cfg -> config of the main server, WLListFilter and WLReportLists
+ */
+static struct wl_list* wl_list_get(apr_pool_t* pconf, server_rec* s, const char* fl, const wl_config* main_cfg)
+{
+    static const trie empty = WL_TRIE_INIT;
+    static const struct wl_bloom none = WL_BLOOM_INIT;
+    struct wl_list* l;
+    apr_finfo_t finfo;
+    int known;
+
+    if (fl == NULL || fl[0] == '\0')
+        return NULL;
+
+    known = apr_stat(&finfo, fl, APR_FINFO_IDENT, pconf) == APR_SUCCESS && finfo.inode != 0;
+    for (l = wl_lists; l != NULL; l = l->next) {
+        if (strcmp(l->path, fl) == 0 || (known && l->inode == finfo.inode && l->device == finfo.device)) {
+            AP_SLOG_DEBUG(s, "list %s shared with %s", fl, l->path);
+            return l;
+        }
     }
-    wl_reset_bots();
-#endif
 
-    agent = wl_xmalloc(sizeof(char) * 256);
-    strcpy(agent, (char*) apr_table_get(rec->headers_in, "User-Agent"));
+    l = apr_pcalloc(pconf, sizeof(struct wl_list));
+    l->path = apr_pstrdup(pconf, fl);
+    l->trie = empty;
+    l->bloom = none;
+    if (known) {
+        l->device = finfo.device;
+        l->inode = finfo.inode;
+    }
+    apr_pool_cleanup_register(pconf, l, wl_list_cleanup, apr_pool_cleanup_null);
+
+    wl_load(l, s);
+    if (l->loaded && main_cfg->filterrate > 0 && l->trie.entries >= (apr_uint32_t) main_cfg->filtermin) {
+        switch (wl_bloom_build(&l->bloom, &l->trie, main_cfg->filterrate)) {
+        case WL_BLOOM_TOO_MANY:
+            AP_SLOG_INFO(s, "list %s holds more than %d prefix lengths, not filtered", fl, WL_BLOOM_MAX_LENS);
+            break;
+        case WL_INDEX_NOMEM:
+            AP_SLOG_ERR(s, "could not map the filter of %s, not filtered", fl);
+            break;
+        }
+    }
 
-#if WL_MODULE_DEBUG_MODE
-    AP_LOG_INFO(rec,  "User agent is: %s", agent);
-#endif
-    
-#if WL_MODULE_DEBUG_MODE
-    AP_LOG_INFO(rec, "Agent: %s did not match any needed user agents", agent);
-#endif
-     addr = wl_reverse_dns(addr);
-     if (addr == NULL) {
-#if WL_MODULE_DEBUG_MODE
-    AP_LOG_INFO(rec, "Couldn't call gethostbyaddr on %s", initial);
-#endif
-        return wl_close(DECLINED);
+    if (main_cfg->report == 1 && l->loaded) {
+        wl_report(s, "list", l->path, &l->trie, NULL);
+        if (l->bloom.blocks != NULL)
+            AP_SLOG_NOTICE(s, "list filter %s: %" APR_SIZE_T_FMT " bytes, %d prefix lengths, %d probes",
+                           fl, (apr_size_t) l->bloom.bytes, l->bloom.nlens, l->bloom.k);
     }
 
+    l->next = wl_lists;
+    wl_lists = l;
 
-#if WL_MODULE_DEBUG_MODE
-    AP_LOG_INFO(rec, "Reverse dns is: %s", addr);
+    return l;
+}
+
+/**
+ * load a WLBotRanges file if it changed on disk,
+ * compile it into the index of the bot and map
+ * that, so every child shares one copy. runs in
+ * the parent, which has no readers to wait for.
+ * a file that can't be read keeps the ranges
+ * already loaded. returns 1 when the index changed
+ *
+ * @param r -> bot with a ranges file
+ * @param s -> server for the log
+ * @param pool -> scratch pool
+ */
+static int wl_ranges_load(struct wl_bot_info* r, server_rec* s, apr_pool_t* pool)
+{
+    static const trie empty = WL_TRIE_INIT;
+    apr_finfo_t finfo;
+    apr_status_t st;
+    trie* t;
+    trie* m;
+    trie* old;
+    unsigned long bad = 0;
+
+    st = apr_stat(&finfo, r->path, APR_FINFO_MTIME, pool);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, st, s, "[" WL_MODULE_LOG_ID "] could not read ranges of %s from %s", r->bot, r->path);
+        return 0;
+    }
+    if (r->trie != NULL && finfo.mtime == r->mtime)
+        return 0;
+
+    t = wl_xmalloc(sizeof(trie));
+    if (t == NULL)
+        return 0;
+    *t = empty;
+
+    if (wl_trie_read_ranges(t, r->path, wl_load_badline, s, &bad) != WL_INDEX_OK) {
+        AP_SLOG_ERR(s, "could not load ranges of %s from %s", r->bot, r->path);
+        wl_trie_free(t);
+        free(t);
+        return 0;
+    }
+    if (bad > 0)
+        AP_SLOG_WARN(s, "skipped %lu values of %s that are not networks", bad, r->path);
+
+    wl_trie_compact(t);
+    r->mtime = finfo.mtime;
+
+    /* the heap copy would be copied on write into
+     * every child, the mapped index is shared */
+    m = wl_xmalloc(sizeof(trie));
+    if (m != NULL) {
+        *m = empty;
+        if (wl_trie_write(t, r->index) == WL_INDEX_OK && wl_trie_map(m, r->index) == WL_INDEX_OK) {
+            wl_trie_free(t);
+            free(t);
+            t = m;
+        }
+        else {
+            AP_SLOG_WARN(s, "could not compile the ranges of %s to %s, running children keep the old ones", r->bot, r->index);
+            free(m);
+            m = NULL;
+        }
+    }
+
+    old = r->trie;
+    r->trie = t;
+    if (old != NULL) {
+        wl_trie_free(old);
+        free(old);
+    }
+
+    AP_SLOG_INFO(s, "loaded %u ranges of %s from %s", t->entries, r->bot, r->path);
+    return m != NULL;
+}
+
+/**
+ * map the index the parent compiled for a bot in
+ * a child and publish it. the old trie is freed
+ * once no request can still be looking at it
+ *
+ * @param r -> bot with a ranges file
+ * @param s -> server for the log
+ */
+static void wl_ranges_attach(struct wl_bot_info* r, server_rec* s)
+{
+    static const trie empty = WL_TRIE_INIT;
+    trie* t;
+    trie* old;
+    int rc;
+
+    t = wl_xmalloc(sizeof(trie));
+    if (t == NULL)
+        return;
+    *t = empty;
+
+    rc = wl_trie_map(t, r->index);
+    if (rc != WL_INDEX_OK) {
+        AP_SLOG_WARN(s, "could not map the ranges of %s from %s (%d), keeping the old ones", r->bot, r->index, rc);
+        free(t);
+        return;
+    }
+
+#if APR_HAS_THREADS
+    if (wl_rcu_lock != NULL)
+        apr_thread_mutex_lock(wl_rcu_lock);
+#endif
+    old = apr_atomic_xchgptr((volatile void**) &r->trie, t);
+#if APR_HAS_THREADS
+    if (wl_rcu_lock != NULL)
+        apr_thread_mutex_unlock(wl_rcu_lock);
 #endif
 
-     if (wl_cfg->spenv == 1) {
-  	apr_table_set(rec->subprocess_env, "MODWL_REVERSE_DNS", addr);
-     }
+    if (old != NULL) {
+        wl_rcu_synchronize();
+        wl_trie_free(old);
+        free(old);
+    }
+}
 
-     addr = wl_forward_dns(addr);
+/**
+ * free the ranges and domains of a bot
+ * with the configuration
+ *
+ * @param data -> bot info
+ */
+static apr_status_t wl_bot_info_cleanup(void* data)
+{
+    struct wl_bot_info* r = data;
 
-     if (wl_cfg->spenv == 1) {
-	apr_table_set(rec->subprocess_env, "MODWL_FORWARD_DNS", addr);
-     }
+    if (r->trie != NULL) {
+        wl_trie_free(r->trie);
+        free(r->trie);
+        r->trie = NULL;
+    }
+    wl_domains_free(r->domains);
+    r->domains = NULL;
 
-#if WL_MODULE_DEBUG_MODE
-    AP_LOG_INFO(rec, "Final conversion of remote ip is: %s", addr);
-#endif 
+    return APR_SUCCESS;
+}
 
-    if (strcasecmp(initial, addr) != 0) {
-        if (wl_cfg->btauto == 1) {
-            wl_append_bot(wl_cfg, agent);
+/**
+ * load the ranges and compile the domains a config
+ * gives, and map every bot name to the nearest info
+ * of it, its own or inherited
+ *
+ * @param wl_cfg -> config of a host
+ * @param s -> server for the log
+ * @param pconf -> configuration pool, frees them on restart
+ * @param ptemp -> scratch pool
+ */
+static void wl_bots_link(wl_config* wl_cfg, server_rec* s, apr_pool_t* pconf, apr_pool_t* ptemp)
+{
+    struct wl_bot_info* r;
+    const wl_config* c;
+    const char* suffix;
+    bitem* bot;
+    int linked, i;
+
+    for (r = wl_cfg->botinfo; r != NULL; r = r->next) {
+        apr_pool_cleanup_register(pconf, r, wl_bot_info_cleanup, apr_pool_cleanup_null);
+
+        if (r->path != NULL) {
+            r->index = ap_runtime_dir_relative(pconf, apr_psprintf(ptemp, WL_RANGES_FILE ".%d", wl_ranges_files++));
+            wl_ranges_load(r, s, ptemp);
         }
 
-        wl_append_bl(rec, initial);
-        wl_append_list(wl_cfg, wl_cfg->blist, initial, rec, 1);
-	apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_FAIL);
-        return wl_close(DECLINED);
+        if (r->suffixes != NULL
+            && wl_domains_build((const char* const*) r->suffixes->elts, r->suffixes->nelts, &r->domains) != WL_MATCHER_OK)
+            AP_SLOG_ERR(s, "could not compile the domains of %s", r->bot);
+
+        /* the same suffixes give the same tag in every
+         * child and generation, verdicts are saved with it */
+        r->tag = 0;
+        if (r->domains != NULL) {
+            r->tag = 2166136261u;
+            for (i = 0; i < r->suffixes->nelts; i++) {
+                suffix = APR_ARRAY_IDX(r->suffixes, i, const char*);
+                r->tag = wl_saved_sum(r->tag, suffix, strlen(suffix) + 1);
+            }
+            if (r->tag == 0 || r->tag == WL_EARNED_ANY)
+                r->tag = 1;
+        }
+
+        linked = 0;
+        for (bot = wl_cfg->bots->snap != NULL ? wl_cfg->bots->snap->bots : NULL; bot != NULL; bot = bot->next)
+            linked |= strcmp(bot->name, r->bot) == 0;
+        if (!linked)
+            AP_SLOG_WARN(s, "WLBotRanges / WLBotDomains %s: no WLBot of that name, not used", r->bot);
     }
-    // add to white list
 
-    wl_append_wl(rec, initial);
-    wl_append_list(wl_cfg, wl_cfg->list, initial, rec, 0);
-    apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_OK);
+    /* the nearest config naming a bot wins */
+    wl_cfg->botmap = apr_hash_make(pconf);
+    wl_cfg->botdomains = 0;
+    for (c = wl_cfg; c != NULL; c = c->botbase) {
+        for (r = c->botinfo; r != NULL; r = r->next) {
+            if (apr_hash_get(wl_cfg->botmap, r->bot, APR_HASH_KEY_STRING) == NULL) {
+                apr_hash_set(wl_cfg->botmap, r->bot, APR_HASH_KEY_STRING, r);
+                wl_cfg->botdomains += r->suffixes != NULL;
+            }
+        }
+    }
+    if (wl_cfg->botdomains > 0)
+        wl_domains_used = 1;
+}
 
-    return wl_close(OK);
+/**
+ * does a verdict earned under the domains tagged
+ * earned vouch for a bot. an address verified for
+ * a bot without WLBotDomains, or with others, has
+ * not shown it belongs to this one
+ *
+ * @param info -> bot info of the claimed bot, NULL for none
+ * @param earned -> domain tag of the verdict
+ */
+static int wl_earned_covers(const struct wl_bot_info* info, apr_uint32_t earned)
+{
+    return info == NULL || info->tag == 0 || earned == WL_EARNED_ANY || earned == info->tag;
 }
 
 /**
- * cleanup any whitelist or
- * blacklist
- * 
- * @param status -> DECLINED or OK
+ * does an OK verdict vouch for the bot a request
+ * claims. only costs a user agent match when the
+ * host has WLBotDomains
+ *
+ * @param rec -> Apache 2 request
+ * @param wl_cfg -> module config of the request
+ * @param earned -> domain tag of the verdict
  */
-static int wl_close(int status)
+static int wl_earned_for(request_rec* rec, wl_config* wl_cfg, apr_uint32_t earned)
 {
-    return (status);
+    const char* agent;
+    const bitem* bot = NULL;
+
+    if (earned == WL_EARNED_ANY || wl_cfg->botdomains == 0 || wl_cfg->botmap == NULL)
+        return 1;
+
+    agent = apr_table_get(rec->headers_in, "User-Agent");
+    if (!wl_in_agents(agent != NULL ? agent : "", rec->pool, wl_cfg->bots, &bot) || bot == NULL)
+        return 1;
+
+    return wl_earned_covers(apr_hash_get(wl_cfg->botmap, bot->name, APR_HASH_KEY_STRING), earned);
 }
 
 /**
- * per server configuration.
+ * may an address verified for a bot be appended to
+ * WLList. the list is trusted before the user agent
+ * is looked at, so once any host has WLBotDomains
+ * only addresses verified under them go in
  *
- * @param pool -> apache's memory pool or HTTPd in this case
- * @param server_rec -> Apache 2 server rec
+ * @param info -> bot info of the claimed bot, NULL for none
  */
-inline static void* wl_server_config(apr_pool_t* pool, server_rec* s)
+static int wl_earned_listable(const struct wl_bot_info* info)
 {
-    wl_config* cfg = apr_pcalloc(pool, sizeof(wl_config));
+    return !wl_domains_used || (info != NULL && info->tag != 0);
+}
 
-    if (cfg) {
-        cfg->enabled = 0;
-        cfg->lenabled = 0;
-        cfg->debug = 0;
-        cfg->list = "";
-        cfg->blist = "";
-        cfg->btlist = "";
-        cfg->bot = "";
-        cfg->btany = 0;
-        cfg->btauto = 0;
-        cfg->bhandler = "";
-        cfg->ahandler = "";
-        cfg->cbot = NULL;
+/**
+ * recompile the range files that changed and tell
+ * the children, called by the parent every
+ * WLBotRangesRefresh seconds
+ *
+ * @param s -> main server
+ * @param pool -> scratch pool
+ */
+static void wl_ranges_refresh(server_rec* s, apr_pool_t* pool)
+{
+    wl_config* cfg;
+    struct wl_bot_info* r;
+    server_rec* sv;
+    int changed = 0;
+
+    for (sv = s; sv != NULL; sv = sv->next) {
+        cfg = (wl_config*) ap_get_module_config(sv->lookup_defaults, &wl_module);
+        for (r = cfg->botinfo; r != NULL; r = r->next) {
+            if (r->path != NULL)
+                changed |= wl_ranges_load(r, sv, pool);
+        }
     }
-    wl_cfg = cfg;
 
-    return cfg;
+    if (changed && wl_flights != NULL)
+        apr_atomic_inc32(&wl_flights->ranges);
 }
 
 /**
- * per directory confiuguration.
+ * map the indexes again once the parent recompiled
+ * any, called by the background thread of each
+ * child. a child forked after the parent mapped
+ * them maps its own copy once more, which is cheap
  *
- * @param pool -> apache's memory pool or HTTPd in this case
- * @param context -> wl config's context
+ * @param w -> writer of the child
  */
-inline static void* wl_dir_config(apr_pool_t* pool, char* context)
+static void wl_ranges_follow(struct wl_writer* w)
 {
-    context = context ? context : "";
-    wl_config* cfg = apr_pcalloc(pool, sizeof(wl_config));
+    wl_config* cfg;
+    struct wl_bot_info* r;
+    server_rec* sv;
+    apr_uint32_t gen;
 
-    if (cfg) {
-        strcpy(cfg->context, context);
-        cfg->enabled = 0;
-        cfg->lenabled = 0;
-        cfg->debug = 0;
-        cfg->list = "";
-        cfg->blist = "";
-        cfg->btlist = "";
-        cfg->btauto = 0;
-        cfg->bot = "";
-        cfg->btany = 0;
-        cfg->bhandler = "";
-        cfg->ahandler = "";
-        cfg->cbot = NULL;
+    if (wl_flights == NULL)
+        return;
+    gen = apr_atomic_read32(&wl_flights->ranges);
+    if (gen == w->ranges)
+        return;
+    w->ranges = gen;
+
+    for (sv = w->s; sv != NULL; sv = sv->next) {
+        cfg = (wl_config*) ap_get_module_config(sv->lookup_defaults, &wl_module);
+        for (r = cfg->botinfo; r != NULL; r = r->next) {
+            if (r->path != NULL)
+                wl_ranges_attach(r, sv);
+        }
     }
-    wl_cfg = cfg;
+}
 
-    return cfg; 
+/**
+ * is the client inside a bot's published ranges
+ *
+ * @param r -> bot info
+ * @param client -> client address
+ */
+static int wl_ranges_in(const struct wl_bot_info* r, const addr* client)
+{
+    apr_uint32_t phase = wl_rcu_enter();
+    const trie* t = r->trie;
+    int found = t != NULL && wl_trie_lookup(t, client->net) >= 0;
+
+    wl_rcu_leave(phase);
+    return found;
 }
 
 /**
- * directives enabled mod_wl
+ * check if this IP is already  
+ * whitelisted
+ * 
+ * @param l -> list of the virtual host, NULL for none
+ * @param client -> parsed client address
+ */
+static int wl_in(const struct wl_list* l, const addr* client)
+{
+    if (l == NULL || !l->loaded)
+        return 0;
+
+    if (!wl_bloom_maybe(&l->bloom, client->net)) {
+        wl_stat_inc(WL_STAT_FILTER_REJECTS);
+        return 0;
+    }
+
+    if (wl_trie_lookup(&l->trie, client->net) >= 0)
+        return 1;
+
+    if (l->bloom.blocks != NULL)
+        wl_stat_inc(WL_STAT_FILTER_FALSE);
+    return 0;
+}
+    
+
+/**
+ * bytes of the verdict table, rounded up to
+ * a cache line. the counters follow it
  *
- * @param cmd -> configuration inherit from httpd.conf
- * @param cfg -> configuration structure
- * @param arg -> config set value
+ * @param nslots -> number of verdict slots
  */
-const char* wl_set_enabled(cmd_parms* cmd, void* cfg, const char* arg)
+static apr_size_t wl_store_size(apr_uint32_t nslots)
 {
-    wl_config* wl_cfg = (wl_config*) cfg;
+    apr_size_t size = sizeof(struct wl_store) + nslots * sizeof(struct wl_slot);
 
-    if (!strcasecmp(arg, "on"))
-            wl_cfg->enabled = 1;
+    return (size + WL_STATS_LINE - 1) / WL_STATS_LINE * WL_STATS_LINE;
+}
+
+/**
+ * create the verdict table and the counters. anonymous
+ * shared memory is inherited by every child, systems
+ * without it get a file backed segment the children
+ * attach to
+ *
+ * @param pconf -> configuration pool
+ * @param s -> main server
+ * @param nslots -> number of verdict slots
+ * @param nstats -> number of counter slots, one per thread
+ */
+static int wl_store_create(apr_pool_t* pconf, server_rec* s, int nslots, int nstats)
+{
+    apr_status_t st;
+    apr_size_t size;
+    uint32_t n = 1;
+
+    /* power of two so the hash is a mask */
+    while (n < (uint32_t) nslots)
+        n <<= 1;
+
+    size = wl_store_size(n) + WL_STATS_LINE + nstats * sizeof(union wl_stat_line)
+        + sizeof(struct wl_flights) + wl_flight_slots(nstats) * sizeof(struct wl_flight);
+    wl_shm_file = NULL;
+
+    st = apr_shm_create(&wl_shm, size, NULL, pconf);
+    if (APR_STATUS_IS_ENOTIMPL(st)) {
+        wl_shm_file = ap_runtime_dir_relative(pconf, WL_STORE_FILE);
+        apr_shm_remove(wl_shm_file, pconf);
+        st = apr_shm_create(&wl_shm, size, wl_shm_file, pconf);
+    }
+    if (st != APR_SUCCESS) {
+        /* still bounded, just not shared */
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] could not create shared verdict table, children keep their own");
+        wl_shm = NULL;
+        wl_shm_file = NULL;
+        wl_store = apr_palloc(pconf, size);
+    } else {
+        wl_store = apr_shm_baseaddr_get(wl_shm);
+    }
+
+    memset(wl_store, 0, size);
+    wl_store->magic = WL_STORE_MAGIC;
+    wl_store->nslots = n;
+
+    wl_stats_locate();
+    wl_stats->nslots = nstats;
+    wl_stats->started = apr_time_now();
+    /* again, the in-flight table follows the counter slots */
+    wl_stats_locate();
+    wl_flights->nslots = wl_flight_slots(nstats);
+
+    return 0;
+}
+
+/**
+ * find the counters and the in-flight table behind
+ * the verdict table, wherever the segment is mapped
+ */
+static void wl_stats_locate(void)
+{
+    if (wl_store == NULL) {
+        wl_stats = NULL;
+        wl_stat_lines = NULL;
+        wl_flights = NULL;
+        return;
+    }
+
+    wl_stats = (struct wl_stats*) ((char*) wl_store + wl_store_size(wl_store->nslots));
+    wl_stat_lines = (union wl_stat_line*) ((char*) wl_stats + WL_STATS_LINE);
+    wl_flights = (struct wl_flights*) (wl_stat_lines + wl_stats->nslots);
+}
+
+/**
+ * the counter slot of the calling thread. claimed
+ * on first use: a free slot, or one left behind by
+ * a child that exited, whose totals carry on. NULL
+ * if every slot is taken
+ */
+static struct wl_stat_slot* wl_stat_slot(void)
+{
+    struct wl_stat_slot* slot;
+    apr_uint32_t pid, owner, i;
+
+    if (wl_stat_claimed || wl_stats == NULL)
+        return wl_stat_mine;
+
+    wl_stat_claimed = 1;
+    pid = (apr_uint32_t) getpid();
+
+    for (i = 0; i < wl_stats->nslots; i++) {
+        slot = &wl_stat_lines[i].slot;
+        owner = apr_atomic_read32(&slot->owner);
+        if (owner != 0 && (owner == pid || kill((pid_t) owner, 0) == 0 || errno != ESRCH))
+            continue;
+        if (apr_atomic_cas32(&slot->owner, pid, owner) == owner) {
+            /* its thread died in a lookup, it no longer counts */
+            if (apr_atomic_xchg32(&slot->indns, 0) != 0 && wl_flights != NULL)
+                apr_atomic_dec32(&wl_flights->busy);
+            wl_stat_mine = slot;
+            return slot;
+        }
+    }
+
+    apr_atomic_inc32(&wl_stats->lost);
+    return NULL;
+}
+
+/**
+ * count an event of the request path
+ *
+ * @param what -> WL_STAT_*
+ */
+static inline void wl_stat_inc(int what)
+{
+    struct wl_stat_slot* slot = wl_stat_slot();
+
+    if (slot != NULL)
+        slot->count[what]++;
+}
+
+/**
+ * count a DNS lookup with its outcome and latency
+ *
+ * @param which -> WL_STAT_REVERSE or WL_STAT_FORWARD
+ * @param status -> WL_DNS_*
+ * @param us -> time the lookup took
+ */
+static void wl_stat_dns(int which, int status, apr_interval_time_t us)
+{
+    struct wl_stat_slot* slot = wl_stat_slot();
+    int b;
+
+    if (slot == NULL)
+        return;
+
+    for (b = 0; b < WL_STATS_BUCKETS - 1 && us > wl_stat_bounds[b]; b++)
+        ;
+
+    slot->count[which == WL_STAT_REVERSE ? WL_STAT_DNS_REVERSE : WL_STAT_DNS_FORWARD]++;
+    if (status != WL_DNS_OK)
+        slot->count[WL_STAT_DNS_NOTFOUND + status - WL_DNS_NOTFOUND]++;
+    slot->dns[which][b]++;
+    slot->dns_us[which] += us;
+}
+
+static inline uint32_t wl_store_hash(const uint32_t* ip)
+{
+    uint32_t h = ip[0];
+    int i;
+
+    for (i = 1; i < 4; i++)
+        h = (h * 2654435761u) ^ ip[i];
+
+    return h * 2654435761u;
+}
+
+static inline int wl_store_key(struct wl_slot* slot, const addr* client)
+{
+    return apr_atomic_read32(&slot->ip[3]) == client->net[3]
+        && apr_atomic_read32(&slot->ip[2]) == client->net[2]
+        && apr_atomic_read32(&slot->ip[1]) == client->net[1]
+        && apr_atomic_read32(&slot->ip[0]) == client->net[0];
+}
+
+/**
+ * look an address up in the verdict table
+ * without taking any lock
+ *
+ * @param client -> client address
+ * @param earned -> set to the domain tag of the verdict
+ */
+static int wl_store_get(const addr* client, apr_uint32_t* earned)
+{
+    struct wl_slot* slot;
+    uint32_t mask, idx, seq, verdict = WL_VERDICT_NONE, expires = 0, tag = 0, now;
+    int i, spin, same = 0;
+
+    if (wl_store == NULL)
+        return WL_VERDICT_NONE;
+
+    now = (apr_uint32_t) apr_time_sec(apr_time_now());
+    mask = wl_store->nslots - 1;
+    idx = wl_store_hash(client->net) & mask;
+
+    for (i = 0; i < WL_STORE_PROBE; i++) {
+        slot = &wl_store->slots[(idx + i) & mask];
+
+        for (spin = 0; spin < 16; spin++) {
+            seq = apr_atomic_read32(&slot->seq);
+            if (seq & 1)
+                continue;
+            same = wl_store_key(slot, client);
+            verdict = apr_atomic_read32(&slot->verdict);
+            expires = apr_atomic_read32(&slot->expires);
+            tag = apr_atomic_read32(&slot->earned);
+            if (apr_atomic_read32(&slot->seq) == seq)
+                break;
+        }
+        if (spin == 16)
+            continue;
+
+        if (verdict != WL_VERDICT_NONE && same) {
+            if (expires <= now)
+                return WL_VERDICT_NONE;
+            /* read first, so hot slots don't bounce their line */
+            if (apr_atomic_read32(&slot->ref) == 0)
+                apr_atomic_set32(&slot->ref, 1);
+            *earned = tag;
+            return (int) verdict;
+        }
+    }
+
+    return WL_VERDICT_NONE;
+}
+
+/**
+ * record a verdict for every child to see. the slot
+ * already holding the address is reused, else a free
+ * or expired one. a full probe window gets CLOCK
+ * style second chances: the slot closest to expiry
+ * among those not hit since the last eviction goes,
+ * so a flood of one-off addresses only evicts each
+ * other and not the bots that keep coming back. when
+ * every slot was hit their bits are cleared and the
+ * one closest to expiry goes. writers of an address
+ * hold its home slot's sequence while they probe, so
+ * two can't store it in different slots. a writer
+ * that loses the race for a slot drops its update
+ *
+ * @param client -> client address
+ * @param verdict -> WL_VERDICT_*
+ * @param ttl -> seconds the verdict holds
+ * @param earned -> tag of the WLBotDomains an OK was reached under
+ */
+static void wl_store_put(const addr* client, int verdict, int ttl, apr_uint32_t earned)
+{
+    struct wl_slot* slot;
+    struct wl_slot* home;
+    struct wl_slot* victim = NULL;
+    struct wl_slot* oldest = NULL;
+    struct wl_slot* cold = NULL;
+    uint32_t mask, idx, seq, hseq, now, taken, expires, ref, oldest_at = 0, cold_at = 0;
+    int i, spin, key, same = 0, live = 0;
+
+    if (wl_store == NULL || ttl <= 0)
+        return;
+
+    now = (apr_uint32_t) apr_time_sec(apr_time_now());
+    mask = wl_store->nslots - 1;
+    idx = wl_store_hash(client->net) & mask;
+
+    home = &wl_store->slots[idx];
+    hseq = apr_atomic_read32(&home->seq);
+    if ((hseq & 1) || apr_atomic_cas32(&home->seq, hseq + 1, hseq) != hseq)
+        return;
+
+    for (i = 0; i < WL_STORE_PROBE; i++) {
+        slot = &wl_store->slots[(idx + i) & mask];
+
+        /* the home slot is ours, the others may be mid write */
+        for (spin = 0; spin < 16; spin++) {
+            seq = slot != home ? apr_atomic_read32(&slot->seq) : 0;
+            if (seq & 1)
+                continue;
+            key = wl_store_key(slot, client);
+            taken = apr_atomic_read32(&slot->verdict);
+            expires = apr_atomic_read32(&slot->expires);
+            ref = apr_atomic_read32(&slot->ref);
+            if (slot == home || apr_atomic_read32(&slot->seq) == seq)
+                break;
+        }
+        if (spin == 16)
+            continue;
+
+        if (taken != WL_VERDICT_NONE && key) {
+            victim = slot;
+            same = 1;
+            break;
+        }
+        if (taken == WL_VERDICT_NONE || expires <= now) {
+            if (victim == NULL)
+                victim = slot;
+        } else {
+            if (oldest == NULL || expires < oldest_at) {
+                oldest = slot;
+                oldest_at = expires;
+            }
+            if (ref == 0 && (cold == NULL || expires < cold_at)) {
+                cold = slot;
+                cold_at = expires;
+            }
+        }
+    }
+
+    if (victim == NULL && cold == NULL) {
+        /* everything was hit, start a new round */
+        for (i = 0; i < WL_STORE_PROBE; i++)
+            apr_atomic_set32(&wl_store->slots[(idx + i) & mask].ref, 0);
+    }
+
+    if (victim == NULL) {
+        victim = cold != NULL ? cold : oldest;
+        live = 1;
+    }
+    if (victim == NULL)
+        goto out;
+
+    if (victim != home) {
+        seq = apr_atomic_read32(&victim->seq);
+        if ((seq & 1) || apr_atomic_cas32(&victim->seq, seq + 1, seq) != seq)
+            goto out;
+    }
+
+    for (i = 0; i < 4; i++)
+        apr_atomic_set32(&victim->ip[i], client->net[i]);
+    apr_atomic_set32(&victim->verdict, verdict);
+    apr_atomic_set32(&victim->expires, now + ttl);
+    apr_atomic_set32(&victim->earned, verdict == WL_VERDICT_OK ? earned : 0);
+    if (!same)
+        apr_atomic_set32(&victim->ref, 0);
+    if (victim != home)
+        apr_atomic_set32(&victim->seq, seq + 2);
+
+    if (live)
+        wl_stat_inc(WL_STAT_EVICTIONS);
+
+out:
+    apr_atomic_set32(&home->seq, hseq + 2);
+}
+
+/**
+ * FNV-1a over the records of a snapshot file
+ *
+ * @param h -> sum so far
+ * @param data -> bytes to add
+ * @param len -> length of data
+ */
+static apr_uint32_t wl_saved_sum(apr_uint32_t h, const void* data, apr_size_t len)
+{
+    const unsigned char* p = data;
+
+    while (len-- > 0)
+        h = (h ^ *p++) * 16777619u;
+
+    return h;
+}
+
+/**
+ * sync the directory holding a file, so a rename
+ * into it is on disk before the old file is gone
+ *
+ * @param pool -> pool for the name
+ * @param path -> file in the directory
+ */
+static void wl_sync_dir(apr_pool_t* pool, const char* path)
+{
+    apr_file_t* dir;
+    char* name = ap_make_dirstr_parent(pool, path);
+
+    if (apr_file_open(&dir, name[0] != '\0' ? name : ".", APR_FOPEN_READ, APR_OS_DEFAULT, pool) != APR_SUCCESS)
+        return;
+    apr_file_sync(dir);
+    apr_file_close(dir);
+}
+
+/**
+ * write the verdicts still alive to a snapshot file.
+ * slots are copied under their seqlock, so children
+ * keep storing verdicts while it runs. the file is
+ * written beside the old one, synced and renamed
+ * over it, a reader never sees half of it and a
+ * crash leaves the old one or the new one
+ *
+ * @param pool -> pool for the file
+ * @param s -> main server
+ * @param path -> snapshot file
+ */
+static void wl_store_save(apr_pool_t* pool, server_rec* s, const char* path)
+{
+    struct wl_saved_header h;
+    struct wl_saved r;
+    struct wl_slot* slot;
+    const char* tmp;
+    apr_file_t* file;
+    apr_status_t st;
+    apr_off_t off = 0;
+    apr_uint32_t i, seq, now;
+    int spin, k;
+
+    if (wl_store == NULL)
+        return;
+
+    tmp = apr_pstrcat(pool, path, ".tmp", NULL);
+    st = apr_file_open(&file, tmp,
+                       APR_FOPEN_WRITE | APR_FOPEN_CREATE | APR_FOPEN_TRUNCATE | APR_FOPEN_BINARY | APR_FOPEN_BUFFERED,
+                       APR_FPROT_UREAD | APR_FPROT_UWRITE, pool);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] couldn't write verdict snapshot %s", tmp);
+        return;
+    }
+
+    now = (apr_uint32_t) apr_time_sec(apr_time_now());
+    memset(&h, 0, sizeof(h));
+    memset(&r, 0, sizeof(r));
+    h.magic = WL_SAVE_MAGIC;
+    h.version = WL_SAVE_VERSION;
+    h.recsize = sizeof(r);
+    h.saved = now;
+    h.sum = 2166136261u;
+
+    /* the header is rewritten with the count and sum at the end */
+    st = apr_file_write_full(file, &h, sizeof(h), NULL);
+
+    for (i = 0; i < wl_store->nslots && st == APR_SUCCESS; i++) {
+        slot = &wl_store->slots[i];
+
+        for (spin = 0; spin < 16; spin++) {
+            seq = apr_atomic_read32(&slot->seq);
+            if (seq & 1)
+                continue;
+            for (k = 0; k < 4; k++)
+                r.ip[k] = apr_atomic_read32(&slot->ip[k]);
+            r.verdict = (uint8_t) apr_atomic_read32(&slot->verdict);
+            r.expires = apr_atomic_read32(&slot->expires);
+            r.ref = (uint8_t) apr_atomic_read32(&slot->ref);
+            r.earned = apr_atomic_read32(&slot->earned);
+            if (apr_atomic_read32(&slot->seq) == seq)
+                break;
+        }
+        if (spin == 16 || r.verdict == WL_VERDICT_NONE || r.verdict > WL_VERDICT_DNSERR || r.expires <= now)
+            continue;
+
+        h.count++;
+        h.sum = wl_saved_sum(h.sum, &r, sizeof(r));
+        st = apr_file_write_full(file, &r, sizeof(r), NULL);
+    }
+
+    if (st == APR_SUCCESS)
+        st = apr_file_seek(file, APR_SET, &off);
+    if (st == APR_SUCCESS)
+        st = apr_file_write_full(file, &h, sizeof(h), NULL);
+    if (st == APR_SUCCESS)
+        st = apr_file_flush(file);
+    if (st == APR_SUCCESS)
+        st = apr_file_sync(file);
+    apr_file_close(file);
+
+    if (st == APR_SUCCESS)
+        st = apr_file_rename(tmp, path, pool);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] couldn't write verdict snapshot %s", path);
+        apr_file_remove(tmp, pool);
+        return;
+    }
+    wl_sync_dir(pool, path);
+
+    AP_SLOG_DEBUG(s, "saved %u verdicts to %s", h.count, path);
+}
+
+/**
+ * fill the new verdict table from a snapshot file,
+ * mapped read-only. a verdict keeps the expiry it
+ * was saved with, cut to what WLCacheTTL allows now,
+ * its CLOCK bit and its domain tag. nothing else uses the table yet,
+ * so slots are written without the seqlock. a verdict
+ * whose probe window is full (a smaller WLSharedSlots)
+ * is dropped
+ *
+ * @param pool -> pool for the mapping
+ * @param s -> main server
+ * @param path -> snapshot file
+ * @param ttl -> WLCacheTTL of each verdict
+ */
+static void wl_store_restore(apr_pool_t* pool, server_rec* s, const char* path, const int* ttl)
+{
+    const struct wl_saved_header* h;
+    const struct wl_saved* r;
+    struct wl_slot* slot;
+    apr_file_t* file;
+    apr_finfo_t finfo;
+    apr_mmap_t* mm;
+    apr_status_t st;
+    apr_uint32_t i, j, mask, idx, now, expires, restored = 0, dropped = 0;
+
+    if (wl_store == NULL)
+        return;
+
+    st = apr_file_open(&file, path, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    if (APR_STATUS_IS_ENOENT(st))
+        return;
+    if (st == APR_SUCCESS)
+        st = apr_file_info_get(&finfo, APR_FINFO_SIZE, file);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] couldn't read verdict snapshot %s", path);
+        return;
+    }
+    if (finfo.size < (apr_off_t) sizeof(*h)) {
+        AP_SLOG_WARN(s, "verdict snapshot %s is damaged, starting empty", path);
+        apr_file_close(file);
+        return;
+    }
+
+    st = apr_mmap_create(&mm, file, 0, (apr_size_t) finfo.size, APR_MMAP_READ, pool);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] couldn't map verdict snapshot %s", path);
+        apr_file_close(file);
+        return;
+    }
+
+    h = mm->mm;
+    r = (const struct wl_saved*) (h + 1);
+    if (h->magic != WL_SAVE_MAGIC || h->version != WL_SAVE_VERSION || h->recsize != sizeof(*r)) {
+        AP_SLOG_WARN(s, "verdict snapshot %s is from another version of mod_wl, starting empty", path);
+        apr_mmap_delete(mm);
+        apr_file_close(file);
+        return;
+    }
+    if ((apr_off_t) (sizeof(*h) + (apr_size_t) h->count * sizeof(*r)) != finfo.size
+        || wl_saved_sum(2166136261u, r, (apr_size_t) h->count * sizeof(*r)) != h->sum) {
+        AP_SLOG_WARN(s, "verdict snapshot %s is damaged, starting empty", path);
+        apr_mmap_delete(mm);
+        apr_file_close(file);
+        return;
+    }
+
+    now = (apr_uint32_t) apr_time_sec(apr_time_now());
+    mask = wl_store->nslots - 1;
+
+    for (i = 0; i < h->count; i++, r++) {
+        if (r->verdict == WL_VERDICT_NONE || r->verdict > WL_VERDICT_DNSERR || ttl[r->verdict] <= 0)
+            continue;
+        expires = r->expires;
+        if (expires > now + (apr_uint32_t) ttl[r->verdict])
+            expires = now + (apr_uint32_t) ttl[r->verdict];
+        if (expires <= now)
+            continue;
+
+        idx = wl_store_hash(r->ip) & mask;
+        for (j = 0; j < WL_STORE_PROBE; j++) {
+            slot = &wl_store->slots[(idx + j) & mask];
+            if (slot->verdict == WL_VERDICT_NONE)
+                break;
+        }
+        if (j == WL_STORE_PROBE) {
+            dropped++;
+            continue;
+        }
+
+        memcpy((void*) slot->ip, r->ip, sizeof(r->ip));
+        slot->verdict = r->verdict;
+        slot->expires = expires;
+        slot->ref = r->ref;
+        slot->earned = r->earned;
+        restored++;
+    }
+
+    AP_SLOG_NOTICE(s, "restored %u of %u verdicts from %s, saved %u seconds ago (%u did not fit)",
+                   restored, h->count, path, now > h->saved ? now - h->saved : 0, dropped);
+
+    apr_mmap_delete(mm);
+    apr_file_close(file);
+}
+
+/**
+ * save the verdicts as the generation ends, on a
+ * graceful or full restart and on stop. registered
+ * on pconf after the table, so it runs before the
+ * table goes away. only the parent saves
+ *
+ * @param data -> main server
+ */
+static apr_status_t wl_store_save_cleanup(void* data)
+{
+    server_rec* s = data;
+    apr_pool_t* pool;
+
+    if (wl_save_file == NULL || getpid() != wl_save_pid)
+        return APR_SUCCESS;
+
+    if (apr_pool_create(&pool, s->process->pool) != APR_SUCCESS)
+        return APR_SUCCESS;
+    wl_store_save(pool, s, wl_save_file);
+    apr_pool_destroy(pool);
+
+    return APR_SUCCESS;
+}
+
+#if AP_SERVER_MAJORVERSION_NUMBER >= 2 && AP_SERVER_MINORVERSION_NUMBER >= 4
+/**
+ * save the verdicts every WLCacheSnapshot interval,
+ * so a crash loses at most that much, and recompile
+ * the WLBotRanges files that changed. runs in the
+ * parent about once a second
+ *
+ * @param p -> configuration pool
+ * @param s -> main server
+ */
+static int wl_monitor(apr_pool_t* p, server_rec* s)
+{
+    apr_pool_t* pool;
+    apr_time_t now = apr_time_now();
+    int save = wl_save_file != NULL && wl_save_every > 0 && now >= wl_save_next;
+    int ranges = wl_ranges_every > 0 && now >= wl_ranges_next;
+
+    if (!save && !ranges)
+        return DECLINED;
+
+    if (apr_pool_create(&pool, p) != APR_SUCCESS)
+        return DECLINED;
+    if (save) {
+        wl_save_next = now + wl_save_every;
+        wl_store_save(pool, s, wl_save_file);
+    }
+    if (ranges) {
+        wl_ranges_next = now + wl_ranges_every;
+        wl_ranges_refresh(s, pool);
+    }
+    apr_pool_destroy(pool);
+
+    return DECLINED;
+}
+#endif
+
+/**
+ * in-flight slots for a number of request threads,
+ * a power of two so the hash is a mask
+ *
+ * @param nstats -> request threads the MPM may run
+ */
+static apr_uint32_t wl_flight_slots(int nstats)
+{
+    apr_uint32_t n = WL_FLIGHT_MIN;
+
+    while (n < 2 * (apr_uint32_t) nstats)
+        n <<= 1;
+
+    return n;
+}
+
+/**
+ * join the verification of an address. the first
+ * request claims a slot and becomes the leader, which
+ * frees it in wl_close once its verdict is stored; a
+ * later one gets the leader's slot to wait on. NULL
+ * when the probe window is taken by other addresses,
+ * the request then verifies on its own
+ *
+ * @param client -> client address
+ * @param timeout -> per lookup deadline in milliseconds
+ * @param leader -> set when the caller claimed the slot
+ */
+static struct wl_flight* wl_flight_join(const addr* client, int timeout, int* leader)
+{
+    struct wl_flight* f;
+    struct wl_flight* claim;
+    apr_uint32_t mask, idx, state, seen, now;
+    int i, spin, claiming;
+
+    *leader = 0;
+    if (wl_flights == NULL)
+        return NULL;
+
+    mask = wl_flights->nslots - 1;
+    idx = wl_store_hash(client->net) & mask;
+
+    /* a slot being claimed may be for this address, so
+     * look again once it is claimed rather than start a
+     * second verification next to it */
+    for (spin = 0; spin < 64; spin++) {
+        now = (apr_uint32_t) apr_time_as_msec(apr_time_now());
+        claim = NULL;
+        seen = WL_FLIGHT_FREE;
+        claiming = 0;
+
+        for (i = 0; i < WL_STORE_PROBE; i++) {
+            f = &wl_flights->slots[(idx + i) & mask];
+            state = apr_atomic_read32(&f->state);
+            /* a leader past its deadline has given up or died.
+             * a claim takes a few stores and never expires */
+            if (state == WL_FLIGHT_BUSY && (apr_int32_t) (now - apr_atomic_read32(&f->deadline)) >= 0) {
+                if (claim == NULL) {
+                    claim = f;
+                    seen = state;
+                }
+                continue;
+            }
+            if (state == WL_FLIGHT_BUSY
+                && apr_atomic_read32(&f->ip[3]) == client->net[3]
+                && apr_atomic_read32(&f->ip[2]) == client->net[2]
+                && apr_atomic_read32(&f->ip[1]) == client->net[1]
+                && apr_atomic_read32(&f->ip[0]) == client->net[0])
+                return f;
+            if (state == WL_FLIGHT_CLAIMING)
+                claiming = 1;
+            if (state == WL_FLIGHT_FREE && claim == NULL) {
+                claim = f;
+                seen = state;
+            }
+        }
+
+        if (claiming)
+            continue;
+        if (claim == NULL)
+            return NULL;
+        if (apr_atomic_cas32(&claim->state, WL_FLIGHT_CLAIMING, seen) != seen)
+            continue;
+
+        for (i = 0; i < 4; i++)
+            apr_atomic_set32(&claim->ip[i], client->net[i]);
+        /* both lookups may take the whole timeout */
+        apr_atomic_set32(&claim->deadline, now + 2 * timeout + WL_FLIGHT_GRACE);
+        apr_atomic_set32(&claim->served, 1);
+        wl_flight_token = apr_atomic_inc32(&wl_flights->tokens);
+        apr_atomic_set32(&claim->token, wl_flight_token);
+        apr_atomic_set32(&claim->state, WL_FLIGHT_BUSY);
+
+        wl_flight_mine = claim;
+        *leader = 1;
+        return claim;
+    }
+
+    return NULL;
+}
+
+/**
+ * wait for the leader of a verification to finish,
+ * polling with a growing sleep since the leader may
+ * be another child. returns 0 when it overran its
+ * deadline
+ *
+ * @param f -> the leader's slot
+ * @param client -> client address
+ */
+static int wl_flight_wait(struct wl_flight* f, const addr* client)
+{
+    apr_interval_time_t pause = 500;
+    apr_uint32_t token = apr_atomic_read32(&f->token);
+
+    while (apr_atomic_read32(&f->state) == WL_FLIGHT_BUSY && apr_atomic_read32(&f->token) == token) {
+        if ((apr_int32_t) ((apr_uint32_t) apr_time_as_msec(apr_time_now()) - apr_atomic_read32(&f->deadline)) >= 0)
+            return 0;
+        apr_sleep(pause);
+        if (pause < WL_FLIGHT_POLL_MAX)
+            pause *= 2;
+    }
+
+    return 1;
+}
+
+/**
+ * free a slot, unless it was taken over
+ * after its deadline
+ *
+ * @param f -> slot
+ * @param token -> claim it was taken with
+ */
+static void wl_flight_release(struct wl_flight* f, apr_uint32_t token)
+{
+    if (apr_atomic_read32(&f->token) == token)
+        apr_atomic_cas32(&f->state, WL_FLIGHT_FREE, WL_FLIGHT_BUSY);
+}
+
+/**
+ * free the slot this thread leads
+ */
+static void wl_flight_leave(void)
+{
+    struct wl_flight* f = wl_flight_mine;
+
+    if (f == NULL)
+        return;
+
+    wl_flight_mine = NULL;
+    wl_flight_release(f, wl_flight_token);
+}
+
+/**
+ * may a verification go to DNS. not while the breaker
+ * is open, except for the one probe after its cooldown,
+ * nor above WLDnsMaxInFlight. returns WL_SHED_NONE,
+ * after which wl_dns_release must follow, or why not
+ *
+ * @param s -> server for the log
+ * @param wl_cfg -> module config
+ * @param probe -> set when this lookup decides if the breaker closes
+ */
+static int wl_dns_admit(server_rec* s, const wl_config* wl_cfg, int* probe)
+{
+    struct wl_breaker* br = wl_flights != NULL ? &wl_flights->breaker : NULL;
+    struct wl_stat_slot* slot;
+    apr_uint32_t now, until, state;
+
+    *probe = 0;
+    if (br != NULL && wl_cfg->breaker[0] > 0 && (state = apr_atomic_read32(&br->state)) != WL_BREAKER_CLOSED) {
+        now = (apr_uint32_t) apr_time_as_msec(apr_time_now());
+        until = apr_atomic_read32(&br->until);
+        if ((apr_int32_t) (now - until) < 0)
+            return WL_SHED_BREAKER;
+        /* cooled down, or the last probe never came back */
+        if (apr_atomic_cas32(&br->until, now + 2 * wl_dns_timeout(wl_cfg) + WL_FLIGHT_GRACE, until) != until)
+            return WL_SHED_BREAKER;
+        apr_atomic_set32(&br->state, WL_BREAKER_HALF);
+        AP_SLOG_INFO(s, "DNS breaker is %s, probing", wl_breaker_names[state]);
+        *probe = 1;
+    }
+
+    /* the probe is not held back, it is one lookup */
+    if (apr_atomic_inc32(&wl_dns_busy) >= (apr_uint32_t) wl_cfg->dnsmax[0] && wl_cfg->dnsmax[0] > 0 && !*probe) {
+        apr_atomic_dec32(&wl_dns_busy);
+        return WL_SHED_CHILD;
+    }
+
+    if (wl_flights != NULL) {
+        if (apr_atomic_inc32(&wl_flights->busy) >= (apr_uint32_t) wl_cfg->dnsmax[1] && wl_cfg->dnsmax[1] > 0 && !*probe) {
+            apr_atomic_dec32(&wl_flights->busy);
+            apr_atomic_dec32(&wl_dns_busy);
+            return WL_SHED_SERVER;
+        }
+        wl_dns_counted = 1;
+
+        /* so a child dying in the lookup gives it back */
+        slot = wl_stat_slot();
+        if (slot != NULL)
+            apr_atomic_set32(&slot->indns, 1);
+    }
+
+    return WL_SHED_NONE;
+}
+
+/**
+ * a verification admitted by wl_dns_admit is done.
+ * a lookup that failed, timed out or was slower than
+ * WLDnsBreaker allows counts against DNS health
+ *
+ * @param s -> server for the log
+ * @param wl_cfg -> module config
+ * @param probe -> from wl_dns_admit
+ * @param status -> WL_DNS_* of the verification
+ * @param us -> time it took
+ */
+static void wl_dns_release(server_rec* s, const wl_config* wl_cfg, int probe, int status, apr_interval_time_t us)
+{
+    struct wl_breaker* br = wl_flights != NULL ? &wl_flights->breaker : NULL;
+    struct wl_stat_slot* slot = wl_stat_slot();
+    apr_uint32_t now, sec, window, total, bad;
+    int slow, failed;
+
+    apr_atomic_dec32(&wl_dns_busy);
+    if (wl_dns_counted) {
+        wl_dns_counted = 0;
+        if (slot == NULL || apr_atomic_xchg32(&slot->indns, 0) != 0)
+            apr_atomic_dec32(&wl_flights->busy);
+    }
+
+    if (br == NULL || wl_cfg->breaker[0] <= 0)
+        return;
+
+    slow = wl_cfg->breaker[2] > 0 ? wl_cfg->breaker[2] : wl_dns_timeout(wl_cfg);
+    failed = status == WL_DNS_TIMEOUT || status == WL_DNS_ERROR || us > (apr_interval_time_t) slow * 1000;
+    now = (apr_uint32_t) apr_time_as_msec(apr_time_now());
+
+    if (probe) {
+        if (failed) {
+            apr_atomic_set32(&br->until, now + wl_cfg->breaker[1] * 1000);
+            apr_atomic_set32(&br->state, WL_BREAKER_OPEN);
+            return;
+        }
+        apr_atomic_set32(&br->total, 0);
+        apr_atomic_set32(&br->bad, 0);
+        apr_atomic_set32(&br->window, (apr_uint32_t) apr_time_sec(apr_time_now()));
+        apr_atomic_set32(&br->state, WL_BREAKER_CLOSED);
+        AP_SLOG_WARN(s, "DNS answers again, verifying");
+        return;
+    }
+
+    if (apr_atomic_read32(&br->state) != WL_BREAKER_CLOSED)
+        return;
+
+    /* counts of a window may lose a few updates
+     * to its rollover, it is a rough health */
+    sec = (apr_uint32_t) apr_time_sec(apr_time_now());
+    window = apr_atomic_read32(&br->window);
+    if (sec - window >= WL_BREAKER_WINDOW && apr_atomic_cas32(&br->window, sec, window) == window) {
+        apr_atomic_set32(&br->total, 0);
+        apr_atomic_set32(&br->bad, 0);
+    }
+
+    total = apr_atomic_inc32(&br->total) + 1;
+    bad = failed ? apr_atomic_inc32(&br->bad) + 1 : apr_atomic_read32(&br->bad);
+    if (!failed || total < WL_BREAKER_MIN || bad * 100 < total * (apr_uint32_t) wl_cfg->breaker[0])
+        return;
+
+    apr_atomic_set32(&br->until, now + wl_cfg->breaker[1] * 1000);
+    if (apr_atomic_cas32(&br->state, WL_BREAKER_OPEN, WL_BREAKER_CLOSED) == WL_BREAKER_CLOSED) {
+        AP_SLOG_WARN(s, "DNS unhealthy, %u of %u lookups bad. not verifying for %d seconds", bad, total, wl_cfg->breaker[1]);
+        wl_stat_inc(WL_STAT_BREAKER_OPENED);
+    }
+}
+
+/**
+ * create a bot item with its own copy of the
+ * name, freed with the snapshot. it is only added
+ * to the configuration by wl_bots_publish. returns
+ * next unchanged when out of memory
+ *
+ * @param bot -> user agent substring (for bot). i.e: Yandex/2.1
+ * @param literal -> match bot as a substring rather than a regex
+ * @param next -> bots created before this one
+ */
+static bitem* wl_bot_new(const char* bot, int literal, bitem* next)
+{
+    bitem* item = (bitem*) wl_xmalloc(sizeof(bitem));
+    char* name = wl_xmalloc(strlen(bot) + 1);
+
+    if (item == NULL || name == NULL) {
+        free(item);
+        free(name);
+        return next;
+    }
+
+    item->name = strcpy(name, bot);
+    item->literal = literal;
+    item->data = NULL;
+    item->next = next;
+
+    return item;
+}
+
+/**
+ * is a bot of that name published already
+ *
+ * @param wl_cfg -> config holding the snapshot
+ * @param name -> bot name
+ */
+static int wl_bot_known(wl_config* wl_cfg, const char* name)
+{
+    const struct wl_snapshot* snap;
+    const bitem* bot;
+    apr_uint32_t phase;
+    int known = 0;
+
+    phase = wl_rcu_enter();
+    snap = wl_cfg->snap;
+    for (bot = snap != NULL ? snap->bots : NULL; bot != NULL && !known; bot = bot->next)
+        known = strcmp(bot->name, name) == 0;
+    wl_rcu_leave(phase);
+
+    return known;
+}
+
+/**
+ * WLBotAutoAdd: hand the user agent of a client
+ * that failed the forward lookup to the writer,
+ * which publishes what queued up in one matcher
+ * build. an agent already known, or one past
+ * WL_BOTS_AUTO_MAX, is not added
+ *
+ * @param rec -> Apache 2 request
+ * @param wl_cfg -> module config of the request
+ * @param agent -> User-Agent of the request
+ */
+static void wl_bots_auto(request_rec* rec, wl_config* wl_cfg, const char* agent)
+{
+    struct wl_writer* w = &wl_writer;
+    char* name = apr_pstrdup(rec->pool, agent);
+    bitem* add;
+
+    /* matched with spaces skipped, like WLBot values */
+    wl_strip_ip(name, " ");
+    if (apr_atomic_read32(&wl_bots_added) >= WL_BOTS_AUTO_MAX || wl_bot_known(wl_cfg->bots, name))
+        return;
+
+    add = wl_bot_new(name, 1, NULL);
+    if (add == NULL) {
+        AP_LOG_ERR(rec, "WL could not allocate an auto added bot");
+        return;
+    }
+    add->data = wl_cfg->bots;
+
+    if (w->thread != NULL) {
+        apr_thread_mutex_lock(w->lock);
+        if (w->nbots < WL_BOTS_AUTO_QUEUE) {
+            add->next = w->bots;
+            w->bots = add;
+            w->nbots++;
+            add = NULL;
+        }
+        apr_thread_mutex_unlock(w->lock);
+
+        /* a full queue drops it, the next mismatch tries again */
+        wl_bots_free(add);
+        return;
+    }
+
+    wl_bots_adopt(rec->server, rec->pool, add);
+}
+
+/**
+ * publish queued WLBotAutoAdd bots, one matcher
+ * build for each config they go to. drops the
+ * ones published since they were queued, the
+ * repeats and those past WL_BOTS_AUTO_MAX
+ *
+ * @param s -> server for the log
+ * @param pool -> pool for the error message
+ * @param queued -> bots, data is the config each goes to
+ */
+static void wl_bots_adopt(server_rec* s, apr_pool_t* pool, bitem* queued)
+{
+    wl_config* wl_cfg;
+    bitem* add;
+    bitem* bot;
+    bitem* dup;
+    bitem** next;
+    const char* err;
+    apr_uint32_t n;
+
+    while (queued != NULL) {
+        wl_cfg = (wl_config*) queued->data;
+        add = NULL;
+        n = 0;
+
+        for (next = &queued; (bot = *next) != NULL; ) {
+            if (bot->data != wl_cfg) {
+                next = &bot->next;
+                continue;
+            }
+            *next = bot->next;
+
+            for (dup = add; dup != NULL && strcmp(dup->name, bot->name) != 0; dup = dup->next)
+                ;
+            if (dup != NULL || apr_atomic_read32(&wl_bots_added) + n >= WL_BOTS_AUTO_MAX
+                || wl_bot_known(wl_cfg, bot->name)) {
+                bot->next = NULL;
+                wl_bots_free(bot);
+                continue;
+            }
+
+            bot->data = NULL;
+            bot->next = add;
+            add = bot;
+            n++;
+        }
+
+        if (add == NULL)
+            continue;
+
+        if ((err = wl_bots_publish(pool, wl_cfg, add)) != NULL) {
+            AP_SLOG_ERR(s, "%s", err);
+            wl_bots_free(add);
+            continue;
+        }
+
+        if (apr_atomic_add32(&wl_bots_added, n) + n >= WL_BOTS_AUTO_MAX)
+            AP_SLOG_WARN(s, "WLBotAutoAdd added %d bots in this child, adding no more", WL_BOTS_AUTO_MAX);
+        while (n-- > 0)
+            wl_stat_inc(WL_STAT_BOTS_ADDED);
+    }
+}
+
+/**
+ * gets rid of any extra characters this ip addr
+ * may have.
+ *
+ * @param addr -> IPv4 address
+ * @param strip -> character delimiter
+ */
+static void wl_strip_ip(char *addr, char* strip)
+{
+    char *p, *q;
+
+    for (q = p = addr; *p; p++)
+        if (*p != *strip)
+            *q++ = *p;
+
+    *q = '\0';
+}
+
+/**
+ * load a list of user agents
+ *
+ * @param fl -> path to file
+ * @param pool -> configuration pool
+ * @param s -> server the list belongs to
+ * @param wl_cfg -> config the bots are added to
+ */
+static void wl_load_bots(char* fl, apr_pool_t* pool, server_rec* s, wl_config* wl_cfg)
+{
+    apr_file_t* wl_file;
+    apr_status_t wl_st;
+    apr_size_t datalen = 256;
+    char data[256]; 
+    bitem* add = NULL;
+    const char* err;
+
+    wl_st = apr_file_open(&wl_file, fl, APR_FOPEN_CREATE | APR_FOPEN_READ, 0, pool);
+
+    // Can't use file..
+    if (!(wl_st == APR_SUCCESS))
+	return;
+
+    while (apr_file_gets(data, datalen, wl_file) == APR_SUCCESS) {
+        if (!strcasecmp(data, ""))
+            continue;
+
+        wl_strip_ip(data, " ");
+        wl_strip_ip(data, "\n");
+
+        add = wl_bot_new(data, wl_bot_is_literal(data), add);
+    }
+
+    wl_st = apr_file_close(wl_file);
+
+    /* one matcher build for the whole file */
+    if ((err = wl_bots_publish(pool, wl_cfg, add)) != NULL)
+        AP_SLOG_ERR(s, "%s", err);
+}
+
+/**
+ * log what a loaded list costs
+ *
+ * @param s -> server the list belongs to
+ * @param what -> list name for the log
+ * @param fl -> list file
+ * @param t -> the loaded address list
+ * @param wl_cfg -> config holding the bots, NULL for address lists
+ */
+static void wl_report(server_rec* s, const char* what, const char* fl, const trie* t, wl_config* wl_cfg)
+{
+    const matcher* m = NULL;
+    bitem* bot = NULL;
+    apr_size_t bytes;
+    int nbots = 0;
+
+    if (wl_cfg == NULL) {
+        AP_SLOG_NOTICE(s, "%s %s: %u entries, %" APR_SIZE_T_FMT " bytes %s",
+                       what, fl, t->entries, (apr_size_t) wl_trie_bytes(t),
+                       t->map != NULL ? "mapped" : "on the heap");
+        return;
+    }
+
+    /* runs in the parent, no reader can race a swap */
+    if (wl_cfg->snap != NULL) {
+        bot = wl_cfg->snap->bots;
+        m = wl_cfg->snap->matcher;
+    }
+
+    bytes = sizeof(struct wl_snapshot);
+    for (; bot != NULL; bot = bot->next) {
+        bytes += sizeof(bitem) + strlen(bot->name) + 1;
+        nbots++;
+    }
+
+    if (m != NULL)
+        bytes += sizeof(matcher) + sizeof(int32_t) * m->nstates * (m->nclasses + 1)
+               + sizeof(regex_t) * m->nrgx;
+
+    AP_SLOG_NOTICE(s, "%s %s: %d patterns, %d automaton states, %d expressions, %" APR_SIZE_T_FMT " bytes",
+                   what, fl, nbots, m ? m->nstates : 0, m ? m->nrgx : 0, bytes);
+}
+
+/**
+ * compile the policy of every virtual host once in
+ * the parent so children inherit it copy-on-write
+ * instead of each loading a private copy on its
+ * first request. list files are loaded once and
+ * shared by every host naming them, bots once per
+ * config that sets them
+ *
+ * @param pconf -> configuration pool
+ * @param pool -> pool for file handles
+ * @param s -> main server
+ */
+static void wl_preload(apr_pool_t* pconf, apr_pool_t* pool, server_rec* s)
+{
+    wl_config* main_cfg = (wl_config*) ap_get_module_config(s->lookup_defaults, &wl_module);
+    apr_hash_t* linked = apr_hash_make(pool);
+    struct wl_policy* policy;
+    wl_config* cfg;
+    wl_config* bots;
+    server_rec* sv;
+
+    /* the lists of the last generation went with its pool */
+    wl_lists = NULL;
+    wl_domains_used = 0;
+    wl_ranges_files = 0;
+
+    for (sv = s; sv != NULL; sv = sv->next) {
+        cfg = (wl_config*) ap_get_module_config(sv->lookup_defaults, &wl_module);
+
+        /* a host without mod_wl directives has the main server's */
+        if (cfg->policy != NULL)
+            continue;
+
+        bots = cfg->bots;
+        if (apr_hash_get(linked, &bots, sizeof(bots)) == NULL) {
+            apr_hash_set(linked, apr_pmemdup(pool, &bots, sizeof(bots)), sizeof(bots), bots);
+
+            if (strcasecmp(bots->btlist, "")) {
+                wl_load_bots(bots->btlist, pconf, sv, bots);
+                if (main_cfg->report == 1)
+                    wl_report(sv, "bot list", bots->btlist, NULL, bots);
+            }
+        }
+
+        wl_bots_link(cfg, sv, pconf, pool);
+
+        policy = apr_pcalloc(pconf, sizeof(struct wl_policy));
+        policy->list = wl_list_get(pconf, sv, cfg->list, main_cfg);
+        policy->blist = wl_list_get(pconf, sv, cfg->blist, main_cfg);
+        cfg->policy = policy;
+    }
+}
+
+/**
+ * answer a request from a shared verdict. returns 0
+ * when there is none to act on
+ *
+ * @param rec -> Apache 2 request
+ * @param addr -> client address as text
+ * @param verdict -> WL_VERDICT_* from the verdict table
+ * @param status -> what wl_init returns
+ */
+static int wl_verdict(request_rec* rec, const char* addr, int verdict, int* status)
+{
+    switch (verdict) {
+    case WL_VERDICT_OK:
+        AP_LOG_INFO(rec, "Found address: %s in shared verdicts. will not reverse/forward DNS", addr);
+        wl_stat_inc(WL_STAT_CACHED_OK);
+        apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_OK);
+        *status = OK;
+        return 1;
+    case WL_VERDICT_FAIL:
+        AP_LOG_INFO(rec, "Found address: %s in shared verdicts as failed. rejecting request", addr);
+        wl_stat_inc(WL_STAT_CACHED_FAIL);
+        apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_FAIL);
+        *status = DECLINED;
+        return 1;
+    case WL_VERDICT_DNSERR:
+        AP_LOG_INFO(rec, "DNS for address: %s failed recently. not retrying yet", addr);
+        wl_stat_inc(WL_STAT_CACHED_DNSERR);
+        *status = DECLINED;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * give a connection room for the verdict on its
+ * client. HTTP/2 streams use their master's
+ *
+ * @param c -> new connection
+ * @param csd -> its socket
+ */
+static int wl_pre_connection(conn_rec* c, void* csd)
+{
+#if AP_MODULE_MAGIC_AT_LEAST(20120211, 52)
+    if (c->master != NULL)
+        return OK;
+#endif
+
+    ap_set_module_config(c->conn_config, &wl_module, apr_pcalloc(c->pool, sizeof(struct wl_conn)));
+    return OK;
+}
+
+/**
+ * the verdict room of a connection, NULL if it
+ * was opened before mod_wl was loaded
+ *
+ * @param c -> connection of a request
+ */
+static struct wl_conn* wl_conn_of(conn_rec* c)
+{
+#if AP_MODULE_MAGIC_AT_LEAST(20120211, 52)
+    if (c->master != NULL)
+        c = c->master;
+#endif
+
+    return (struct wl_conn*) ap_get_module_config(c->conn_config, &wl_module);
+}
+
+/**
+ * answer a request from the verdict an earlier request
+ * on its connection reached, with the same MODWL_*
+ * values. a proxy may send other clients over the same
+ * connection, so the address has to match. returns 0
+ * when there is nothing to reuse
+ *
+ * @param rec -> Apache 2 request
+ * @param wl_cfg -> module config of the request
+ * @param client -> client address
+ * @param status -> what wl_init returns
+ */
+static int wl_conn_reuse(request_rec* rec, const wl_config* wl_cfg, const addr* client, int* status)
+{
+    struct wl_conn* cv = wl_conn_of(rec->connection);
+    struct wl_conn copy;
+    apr_uint32_t seq;
+    int spin;
+
+    if (cv == NULL || cv->expires == 0)
+        return 0;
+
+    for (spin = 0; spin < 16; spin++) {
+        seq = apr_atomic_read32(&cv->seq);
+        if (seq & 1)
+            continue;
+        memcpy(&copy, cv, sizeof(copy));
+        if (apr_atomic_read32(&cv->seq) == seq)
+            break;
+    }
+    if (spin == 16)
+        return 0;
+
+    if (copy.cfg != wl_cfg || copy.expires <= apr_time_now() || !wl_addr_same(&copy.client, client))
+        return 0;
+
+    /* a later request may claim a bot with other domains */
+    if (copy.status == OK && !wl_earned_for(rec, (wl_config*) wl_cfg, copy.earned))
+        return 0;
+
+    if (copy.mstatus[0] != '\0')
+        apr_table_set(rec->subprocess_env, "MODWL_STATUS", copy.mstatus);
+    if (wl_cfg->spenv == 1 && copy.reverse[0] != '\0') {
+        apr_table_set(rec->subprocess_env, "MODWL_REVERSE_DNS", copy.reverse);
+        apr_table_set(rec->subprocess_env, "MODWL_FORWARD_DNS", copy.forward);
+    }
+
+    wl_stat_inc(WL_STAT_CONN_REUSED);
+    *status = copy.status;
+    return 1;
+}
+
+/**
+ * remember the verdict on a request's client for the
+ * rest of its connection, with the MODWL_* values set
+ * so far. returns status
+ *
+ * @param rec -> Apache 2 request
+ * @param wl_cfg -> module config of the request
+ * @param client -> client address
+ * @param status -> what wl_init returns
+ * @param ttl -> seconds the verdict holds, 0 not to keep it
+ * @param earned -> domain tag of an OK, as in a verdict slot
+ */
+static int wl_conn_keep(request_rec* rec, const wl_config* wl_cfg, const addr* client, int status, int ttl, apr_uint32_t earned)
+{
+    struct wl_conn* cv = wl_conn_of(rec->connection);
+    const char* v;
+    apr_uint32_t seq;
+
+    if (cv == NULL || ttl <= 0)
+        return status;
+
+    /* a stream writing it at the same time wins */
+    seq = apr_atomic_read32(&cv->seq);
+    if ((seq & 1) || apr_atomic_cas32(&cv->seq, seq + 1, seq) != seq)
+        return status;
+
+    cv->cfg = wl_cfg;
+    cv->client = *client;
+    cv->status = status;
+    cv->earned = earned;
+    cv->expires = apr_time_now() + apr_time_from_sec(ttl);
+    v = apr_table_get(rec->subprocess_env, "MODWL_STATUS");
+    apr_cpystrn(cv->mstatus, v != NULL ? v : "", sizeof(cv->mstatus));
+    v = apr_table_get(rec->subprocess_env, "MODWL_REVERSE_DNS");
+    apr_cpystrn(cv->reverse, v != NULL ? v : "", sizeof(cv->reverse));
+    v = apr_table_get(rec->subprocess_env, "MODWL_FORWARD_DNS");
+    apr_cpystrn(cv->forward, v != NULL ? v : "", sizeof(cv->forward));
+
+    apr_atomic_set32(&cv->seq, seq + 2);
+    return status;
+}
+
+#if WL_MODULE_DEBUG_MODE
+/**
+ * log the bots of the current snapshot
+ *
+ * @param rec -> Apache 2 request
+ * @param wl_cfg -> module config
+ */
+static void wl_log_bots(request_rec* rec, wl_config* wl_cfg)
+{
+    const struct wl_snapshot* snap;
+    const bitem* bot;
+    apr_uint32_t phase = wl_rcu_enter();
+
+    snap = wl_cfg->snap;
+    for (bot = snap != NULL ? snap->bots : NULL; bot != NULL; bot = bot->next)
+        AP_LOG_DEBUG(rec, "Initialized bot: %s", bot->name);
+
+    wl_rcu_leave(phase);
+}
+#endif
+
+/**
+ * checks whether an incoming request
+ * needs to be blocked
+ * 
+ * @param rec -> Apache 2 request
+ */
+static int wl_init(request_rec* rec)
+{
+    char* addr;
+    char* initial;
+    const char* agent;
+    const bitem* bot;
+    const struct wl_bot_info* info;
+    struct wl_addr client;
+    struct wl_addr fwd;
+    wl_dns_multi dns;
+    struct wl_flight* flight;
+    int client_ok = 1;
+    int cached;
+    int verdict;
+    int leader;
+    int probe;
+    int shed;
+    apr_time_t start;
+    int dns_st;
+    apr_uint32_t earned = 0;
+    AP_LOG_DEBUG(rec, "wl_init called");
+    wl_config* wl_cfg = (wl_config*) ap_get_module_config(rec->per_dir_config, &wl_module);
+    const struct wl_policy* policy = wl_cfg->policy;
+        
+    if (wl_cfg->spenv == 1) {
+	    apr_table_set(rec->subprocess_env, "MODWL_BOTS", wl_cfg->bot);
+    }
+
+    if (wl_cfg->enabled != 1 || policy == NULL) {
+        return (OK);
+    }
+
+    wl_stat_inc(WL_STAT_REQUESTS);
+
+#if AP_SERVER_MAJORVERSION_NUMBER >= 2 && AP_SERVER_MINORVERSION_NUMBER >= 4
+    /* the client behind a trusted proxy when mod_remoteip is used */
+    addr = initial = rec->useragent_ip;
+#else
+    addr = initial = rec->connection->remote_ip;
+#endif
+
+    if (wl_cfg->spenv == 1) {
+	apr_table_set(rec->subprocess_env, "MODWL_ORIGINAL", addr);
+    }
+
+    if (wl_create_addr(addr, &client) != 0) {
+      AP_LOG_INFO(rec, "could not parse client address: %s. skipping list lookups", addr);
+      client_ok = 0;
+    }
+
+    /* keep-alive and HTTP/2: decided on this connection already */
+    if (client_ok && wl_conn_reuse(rec, wl_cfg, &client, &cached))
+      return cached;
+
+    if ( client_ok && wl_in(policy->list, &client)  == 1) {
+      AP_LOG_INFO(rec, "Found address: %s in whitelist. will not reverse/forward DNS", addr);
+      wl_stat_inc(WL_STAT_WL_HITS);
+      return wl_conn_keep(rec, wl_cfg, &client, OK, wl_cfg->ttl[WL_VERDICT_OK], WL_EARNED_ANY);
+    }
+
+    if ( client_ok && wl_in(policy->blist, &client)  == 1) {
+      AP_LOG_INFO(rec, "Found address: %s in blacklist. rejecting request", addr);
+      wl_stat_inc(WL_STAT_BL_HITS);
+      return wl_conn_keep(rec, wl_cfg, &client, DECLINED, wl_cfg->ttl[WL_VERDICT_FAIL], 0);
+    }
+
+    /* an OK earned without the domains of the bot claimed
+     * now does not vouch for it, verify under them */
+    if (client_ok && (verdict = wl_store_get(&client, &earned)) == WL_VERDICT_OK && !wl_earned_for(rec, wl_cfg, earned)) {
+      AP_LOG_INFO(rec, "address: %s was verified for a bot with other domains. verifying", addr);
+      verdict = WL_VERDICT_NONE;
+    }
+
+    if (client_ok && wl_verdict(rec, addr, verdict, &cached))
+      return wl_conn_keep(rec, wl_cfg, &client, cached, wl_cfg->ttl[verdict], earned);
+
+
+#if WL_MODULE_DEBUG_MODE
+    /* a walk over every bot, keep it off the request path */
+    if (APLOG_R_IS_LEVEL(rec, APLOG_DEBUG)) {
+        AP_LOG_DEBUG(rec, "Original remote ip is: %s", addr);
+        wl_log_bots(rec, wl_cfg->bots);
+    }
+#endif
+
+    /* read in place, only WLBotAutoAdd keeps a copy */
+    agent = apr_table_get(rec->headers_in, "User-Agent");
+    if (agent == NULL)
+        agent = "";
+
+#if WL_MODULE_DEBUG_MODE
+    AP_LOG_DEBUG(rec, "User agent is: %s", agent);
+#endif
+
+    /* only requests claiming to be a listed bot pay for DNS */
+    if (!wl_in_agents(agent, rec->pool, wl_cfg->bots, &bot)) {
+#if WL_MODULE_DEBUG_MODE
+        AP_LOG_DEBUG(rec, "Agent: %s did not match any needed user agents", agent);
+#endif
+        wl_stat_inc(WL_STAT_AGENT_SKIPPED);
+        return wl_close(OK);
+    }
+
+    if (!client_ok) {
+        return wl_close(DECLINED);
+    }
+
+    /* inside the ranges the claimed bot publishes: no DNS */
+    info = bot != NULL && wl_cfg->botmap != NULL ? apr_hash_get(wl_cfg->botmap, bot->name, APR_HASH_KEY_STRING) : NULL;
+    if (info != NULL && wl_ranges_in(info, &client)) {
+        AP_LOG_INFO(rec, "Found address: %s in the published ranges of %s. will not reverse/forward DNS", addr, bot->name);
+        wl_stat_inc(WL_STAT_RANGE_HITS);
+        apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_OK);
+        return wl_close(wl_conn_keep(rec, wl_cfg, &client, OK, wl_cfg->ttl[WL_VERDICT_OK], info->tag));
+    }
+
+    /* a verification of this address already running
+     * in any child: wait for its verdict instead */
+    flight = wl_flight_join(&client, wl_dns_timeout(wl_cfg), &leader);
+    if (flight != NULL && !leader) {
+        /* checked in the background: pass within the budget */
+        if (wl_cfg->verifymode == WL_VERIFY_BACKGROUND
+            && (wl_cfg->verifybudget == 0 || apr_atomic_inc32(&flight->served) < (apr_uint32_t) wl_cfg->verifybudget)) {
+            wl_stat_inc(WL_STAT_PENDING_PASS);
+            apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_PENDING);
+            return wl_close(OK);
+        }
+        if (!wl_flight_wait(flight, &client)) {
+            AP_LOG_INFO(rec, "verification of %s by another request timed out. verifying", addr);
+            wl_stat_inc(WL_STAT_COALESCE_TIMEOUTS);
+        } else if ((verdict = wl_store_get(&client, &earned)) == WL_VERDICT_OK && !wl_earned_covers(info, earned)) {
+            /* the leader verified for a bot with other domains */
+            AP_LOG_INFO(rec, "verification of %s by another request was for other domains. verifying", addr);
+        } else if (wl_verdict(rec, addr, verdict, &cached)) {
+            wl_stat_inc(WL_STAT_COALESCED);
+            return wl_conn_keep(rec, wl_cfg, &client, cached, wl_cfg->ttl[verdict], earned);
+        }
+    }
+
+    /* serve now, the verdict applies from the next request */
+    if (wl_cfg->verifymode == WL_VERIFY_BACKGROUND && leader
+        && wl_checker_queue(rec, wl_cfg, &client, initial, info, flight)) {
+        AP_LOG_INFO(rec, "verifying %s in the background", addr);
+        wl_stat_inc(WL_STAT_PENDING_PASS);
+        apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_PENDING);
+        return wl_close(OK);
+    }
+
+    /* DNS is slow or saturated: apply WLDnsOverload rather
+     * than tie up another worker. nothing is cached */
+    shed = wl_dns_admit(rec->server, wl_cfg, &probe);
+    if (shed != WL_SHED_NONE) {
+        AP_LOG_INFO(rec, "not verifying %s, DNS %s", addr, shed == WL_SHED_BREAKER ? "breaker is open" : "lookups at their limit");
+        wl_stat_inc(shed == WL_SHED_BREAKER ? WL_STAT_SHED_BREAKER : WL_STAT_SHED_BUSY);
+        apr_table_set(rec->subprocess_env, "MODWL_SHED", wl_shed_names[shed]);
+        apr_table_set(rec->subprocess_env, "MODWL_STATUS", wl_cfg->dnsfailopen ? WL_MODULE_STATUS_OK : WL_MODULE_STATUS_FAIL);
+        return wl_close(wl_cfg->dnsfailopen ? OK : DECLINED);
+    }
+
+    start = apr_time_now();
+    dns_st = wl_dns_verify(rec->pool, wl_dns_timeout(wl_cfg), &client, info != NULL ? info->domains : NULL, &dns);
+    wl_dns_release(rec->server, wl_cfg, probe, dns_st, apr_time_now() - start);
+    if (dns_st != WL_DNS_OK) {
+#if WL_MODULE_DEBUG_MODE
+    AP_LOG_INFO(rec, "Couldn't reverse/forward %s: lookup %s", initial, wl_dns_status[dns_st]);
+#endif
+        /* no PTR record is a definite answer, anything else may heal */
+        verdict = dns_st == WL_DNS_NOTFOUND ? WL_VERDICT_FAIL : WL_VERDICT_DNSERR;
+        if (verdict == WL_VERDICT_FAIL) {
+            wl_stat_inc(WL_STAT_VERIFY_FAIL);
+            apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_FAIL);
+        }
+        wl_store_put(&client, verdict, wl_cfg->ttl[verdict], 0);
+        return wl_close(wl_conn_keep(rec, wl_cfg, &client, DECLINED, wl_cfg->ttl[verdict], 0));
+    }
+    addr = dns.wl_dns_reverse;
+
+
+#if WL_MODULE_DEBUG_MODE
+    AP_LOG_INFO(rec, "Reverse dns is: %s", addr);
+#endif
+
+     if (wl_cfg->spenv == 1) {
+  	apr_table_set(rec->subprocess_env, "MODWL_REVERSE_DNS", addr);
+     }
+
+     addr = dns.wl_dns_forward;
+
+     if (wl_cfg->spenv == 1) {
+	apr_table_set(rec->subprocess_env, "MODWL_FORWARD_DNS", addr);
+     }
+
+#if WL_MODULE_DEBUG_MODE
+    AP_LOG_INFO(rec, "Final conversion of remote ip is: %s", addr);
+#endif 
+
+    /* compare numerically, the forward answer and
+     * client_ip may spell the same IPv6 address differently */
+    if (wl_create_addr(addr, &fwd) != 0 || !wl_addr_same(&client, &fwd)) {
+        if (wl_cfg->btauto == 1 && agent[0] != '\0')
+            wl_bots_auto(rec, wl_cfg, agent);
+
+        wl_stat_inc(WL_STAT_VERIFY_FAIL);
+        wl_store_put(&client, WL_VERDICT_FAIL, wl_cfg->ttl[WL_VERDICT_FAIL], 0);
+        wl_append_list(wl_cfg, wl_cfg->blist, initial, rec->server, rec->pool, 1);
+	apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_FAIL);
+        return wl_close(wl_conn_keep(rec, wl_cfg, &client, DECLINED, wl_cfg->ttl[WL_VERDICT_FAIL], 0));
+    }
+    // add to white list
+
+    wl_stat_inc(WL_STAT_VERIFY_OK);
+    earned = info != NULL ? info->tag : 0;
+    wl_store_put(&client, WL_VERDICT_OK, wl_cfg->ttl[WL_VERDICT_OK], earned);
+    if (wl_earned_listable(info))
+        wl_append_list(wl_cfg, wl_cfg->list, initial, rec->server, rec->pool, 0);
+    apr_table_set(rec->subprocess_env, "MODWL_STATUS", WL_MODULE_STATUS_OK);
+
+    return wl_close(wl_conn_keep(rec, wl_cfg, &client, OK, wl_cfg->ttl[WL_VERDICT_OK], earned));
+}
+
+/**
+ * cleanup any whitelist or
+ * blacklist
+ * 
+ * @param status -> DECLINED or OK
+ */
+static int wl_close(int status)
+{
+    /* the verdict is stored by now, release the waiters */
+    wl_flight_leave();
+    return (status);
+}
+
+/**
+ * per server configuration.
+ *
+ * @param pool -> apache's memory pool or HTTPd in this case
+ * @param server_rec -> Apache 2 server rec
+ */
+inline static void* wl_server_config(apr_pool_t* pool, server_rec* s)
+{
+    wl_config* cfg = apr_pcalloc(pool, sizeof(wl_config));
+
+    if (cfg) {
+        cfg->enabled = 0;
+        cfg->lenabled = 0;
+        cfg->debug = 0;
+        cfg->list = "";
+        cfg->blist = "";
+        cfg->btlist = "";
+        cfg->dnsserver = "";
+        cfg->bot = "";
+        cfg->btany = 0;
+        cfg->btauto = 0;
+        cfg->bhandler = "";
+        cfg->ahandler = "";
+        cfg->snap = NULL;
+        cfg->botinfo = NULL;
+        cfg->botbase = NULL;
+        cfg->botmap = NULL;
+        cfg->botdomains = 0;
+        cfg->bots = cfg;
+        cfg->policy = NULL;
+        cfg->set = 0;
+        cfg->rangesrefresh = WL_RANGES_REFRESH;
+        cfg->dnsmax[0] = 0;
+        cfg->dnsmax[1] = 0;
+        cfg->dnsfailopen = 0;
+        cfg->breaker[0] = WL_BREAKER_BAD;
+        cfg->breaker[1] = WL_BREAKER_COOLDOWN;
+        cfg->breaker[2] = 0;
+        cfg->verifymode = WL_VERIFY_INLINE;
+        cfg->verifybudget = 0;
+        cfg->filterrate = WL_FILTER_RATE;
+        cfg->filtermin = WL_FILTER_MIN;
+        cfg->savefile = "";
+        cfg->saveinterval = WL_SAVE_INTERVAL;
+        cfg->ttl[WL_VERDICT_OK] = WL_TTL_OK;
+        cfg->ttl[WL_VERDICT_FAIL] = WL_TTL_FAIL;
+        cfg->ttl[WL_VERDICT_DNSERR] = WL_TTL_DNSERR;
+        apr_pool_cleanup_register(pool, cfg, wl_snapshot_cleanup, apr_pool_cleanup_null);
+    }
+
+    return cfg;
+}
+
+/**
+ * per directory confiuguration.
+ *
+ * @param pool -> apache's memory pool or HTTPd in this case
+ * @param context -> wl config's context
+ */
+inline static void* wl_dir_config(apr_pool_t* pool, char* context)
+{
+    context = context ? context : "";
+    wl_config* cfg = apr_pcalloc(pool, sizeof(wl_config));
+
+    if (cfg) {
+        strcpy(cfg->context, context);
+        cfg->enabled = 0;
+        cfg->lenabled = 0;
+        cfg->debug = 0;
+        cfg->list = "";
+        cfg->blist = "";
+        cfg->btlist = "";
+        cfg->dnsserver = "";
+        cfg->btauto = 0;
+        cfg->bot = "";
+        cfg->btany = 0;
+        cfg->bhandler = "";
+        cfg->ahandler = "";
+        cfg->snap = NULL;
+        cfg->botinfo = NULL;
+        cfg->botbase = NULL;
+        cfg->botmap = NULL;
+        cfg->botdomains = 0;
+        cfg->bots = cfg;
+        cfg->policy = NULL;
+        cfg->set = 0;
+        cfg->rangesrefresh = WL_RANGES_REFRESH;
+        cfg->dnsmax[0] = 0;
+        cfg->dnsmax[1] = 0;
+        cfg->dnsfailopen = 0;
+        cfg->breaker[0] = WL_BREAKER_BAD;
+        cfg->breaker[1] = WL_BREAKER_COOLDOWN;
+        cfg->breaker[2] = 0;
+        cfg->verifymode = WL_VERIFY_INLINE;
+        cfg->verifybudget = 0;
+        cfg->filterrate = WL_FILTER_RATE;
+        cfg->filtermin = WL_FILTER_MIN;
+        cfg->savefile = "";
+        cfg->saveinterval = WL_SAVE_INTERVAL;
+        cfg->ttl[WL_VERDICT_OK] = WL_TTL_OK;
+        cfg->ttl[WL_VERDICT_FAIL] = WL_TTL_FAIL;
+        cfg->ttl[WL_VERDICT_DNSERR] = WL_TTL_DNSERR;
+        apr_pool_cleanup_register(pool, cfg, wl_snapshot_cleanup, apr_pool_cleanup_null);
+    }
+
+    return cfg; 
+}
+
+/**
+ * merge a virtual host or directory config with the
+ * one it is nested in. what it was given overrides,
+ * the rest is inherited. the bots are not copied:
+ * a config without WLBot / WLBotList uses those of
+ * its base, so a host inheriting them shares their
+ * snapshot. bot info is layered by bot name, the
+ * WLBotRanges / WLBotDomains a host gives apply over
+ * the ones it inherits
+ *
+ * @param pool -> pool of the merged config
+ * @param basev -> enclosing config
+ * @param addv -> config of the host or directory
+ */
+static void* wl_merge_config(apr_pool_t* pool, void* basev, void* addv)
+{
+    wl_config* base = (wl_config*) basev;
+    wl_config* add = (wl_config*) addv;
+    wl_config* cfg = apr_pmemdup(pool, base, sizeof(wl_config));
+
+    strcpy(cfg->context, add->context);
+    cfg->set = base->set | add->set;
+    cfg->snap = NULL;
+    cfg->botinfo = NULL;
+    cfg->botbase = base->botinfo != NULL ? base : base->botbase;
+    cfg->policy = add->policy != NULL ? add->policy : base->policy;
+
+    if (add->set & WL_SET_ENABLED)
+        cfg->enabled = add->enabled;
+    if (add->set & WL_SET_LIST)
+        cfg->list = add->list;
+    if (add->set & WL_SET_LIST_APPEND)
+        cfg->listappend = add->listappend;
+    if (add->set & WL_SET_BLIST)
+        cfg->blist = add->blist;
+    if (add->set & WL_SET_BLIST_APPEND)
+        cfg->blistappend = add->blistappend;
+    if (add->set & WL_SET_BOTS) {
+        cfg->bots = add->bots;
+        cfg->bot = add->bot;
+        cfg->btany = add->btany;
+        cfg->btlist = add->btlist;
+    }
+    if (add->set & WL_SET_BOTINFO) {
+        cfg->botinfo = add->botinfo;
+        /* built again by wl_preload */
+        cfg->botmap = NULL;
+        cfg->botdomains = 0;
+    }
+    if (add->set & WL_SET_BOT_AUTO)
+        cfg->btauto = add->btauto;
+    if (add->set & WL_SET_DNS_TIMEOUT)
+        cfg->dnstimeout = add->dnstimeout;
+    if (add->set & WL_SET_DNS_SERVER)
+        cfg->dnsserver = add->dnsserver;
+    if (add->set & WL_SET_SLOTS)
+        cfg->nslots = add->nslots;
+    if (add->set & WL_SET_TTL)
+        memcpy(cfg->ttl, add->ttl, sizeof(cfg->ttl));
+    if (add->set & WL_SET_DNS_MAX)
+        memcpy(cfg->dnsmax, add->dnsmax, sizeof(cfg->dnsmax));
+    if (add->set & WL_SET_OVERLOAD)
+        cfg->dnsfailopen = add->dnsfailopen;
+    if (add->set & WL_SET_BREAKER)
+        memcpy(cfg->breaker, add->breaker, sizeof(cfg->breaker));
+    if (add->set & WL_SET_VERIFY) {
+        cfg->verifymode = add->verifymode;
+        cfg->verifybudget = add->verifybudget;
+    }
+    if (add->set & WL_SET_FLUSH_INTERVAL)
+        cfg->flushinterval = add->flushinterval;
+    if (add->set & WL_SET_FLUSH_BATCH)
+        cfg->flushbatch = add->flushbatch;
+    if (add->set & WL_SET_FLUSH_SYNC)
+        cfg->flushsync = add->flushsync;
+    if (add->set & WL_SET_REPORT)
+        cfg->report = add->report;
+    if (add->set & WL_SET_SPENV)
+        cfg->spenv = add->spenv;
+    if (add->set & WL_SET_REFRESH)
+        cfg->rangesrefresh = add->rangesrefresh;
+    if (add->set & WL_SET_FILTER) {
+        cfg->filterrate = add->filterrate;
+        cfg->filtermin = add->filtermin;
+    }
+    if (add->set & WL_SET_SAVE) {
+        cfg->savefile = add->savefile;
+        cfg->saveinterval = add->saveinterval;
+    }
+
+    return cfg;
+}
+
+/**
+ * directives enabled mod_wl
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_enabled(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_ENABLED;
+
+    if (!strcasecmp(arg, "on"))
+            wl_cfg->enabled = 1;
+    else
+            wl_cfg->enabled = 0;
+
+    return NULL;
+}
+
+/**
+ * directive enables white lists
+ * 
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_enabled_list(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+
+    if (!strcasecmp(arg, "on"))
+            wl_cfg->lenabled = 1;
+    else
+            wl_cfg->lenabled = 0;
+
+    return NULL;
+}
+
+/**
+ * sets the bot(s) wl will be using
+ * acceptable values are any user agent substring
+ * this option can be given in a "|" delimited
+ * string. ex:
+ * Googlebot/2.1 | bingbot/2.1 | Yahoo Slurp!
+ * or
+ * Googlebot
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_bot(cmd_parms* cmd, void* cfg, const char* args)
+{
+    char* bots;
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_BOTS;
+    bots = ap_getword_conf(cmd->pool, &args);
+
+    wl_strip_ip(bots, " "); 
+    wl_cfg->bot = bots;
+
+    char delims[] = "|";
+    char* piece = NULL;
+    bitem* add = NULL;
+
+    piece = strtok(bots, delims);
+
+    while (piece != NULL) {
+        if (!strcasecmp(piece, "any")) {
+            wl_cfg->btany = 1;
+        }
+
+        add = wl_bot_new(piece, wl_bot_is_literal(piece), add);
+        piece = strtok(NULL, delims);
+    }
+
+    return wl_bots_publish(cmd->pool, wl_cfg, add);
+}
+
+
+/** 
+ * set the timeout for forward and reverse DNS
+ * lookups. takes milliseconds per lookup, On
+ * for the default deadline or Off to wait as
+ * long as the system resolver would
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_dns_timeout(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_DNS_TIMEOUT;
+
+    if (!strcasecmp(arg, "on"))
+            wl_cfg->dnstimeout = WL_DNS_DEFAULT_TIMEOUT;
+    else if (!strcasecmp(arg, "off"))
+            wl_cfg->dnstimeout = 0;
+    else if ((wl_cfg->dnstimeout = atoi(arg)) <= 0)
+            return "WLDnsTimeout takes On, Off or a timeout in milliseconds";
+
+    return NULL;
+}
+
+/** 
+ * add a nameserver to query instead of
+ * the ones in /etc/resolv.conf
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> ip, ip:port or [ipv6]:port
+ */
+const char* wl_set_dns_server(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_DNS_SERVER;
+    struct sockaddr_storage ss;
+    socklen_t len;
+
+    /* validate now, servers are installed in post_config */
+    if (wl_dns_parse_server(arg, &ss, &len) != 0)
+        return apr_psprintf(cmd->pool, "WLDnsServer: invalid nameserver %s", arg);
+
+    wl_cfg->dnsserver = wl_cfg->dnsserver[0] == '\0'
+        ? apr_pstrdup(cmd->pool, arg)
+        : apr_pstrcat(cmd->pool, wl_cfg->dnsserver, " ", arg, NULL);
+
+    return NULL;
+}
+
+/** 
+ * set the number of verdicts kept in
+ * shared memory
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_shared_slots(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_SLOTS;
+
+    wl_cfg->nslots = atoi(arg);
+    if (wl_cfg->nslots < WL_STORE_PROBE || wl_cfg->nslots > (1 << 26))
+        return "WLSharedSlots takes a number of slots between 8 and 67108864";
+
+    return NULL;
+}
+
+/**
+ * file the shared verdicts are saved to when Apache
+ * restarts or stops, and every interval seconds in
+ * between, to be read back on start
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param path -> snapshot file, relative to ServerRoot
+ * @param interval -> seconds between snapshots, 0 for restarts only
+ */
+const char* wl_set_cache_snapshot(cmd_parms* cmd, void* cfg, const char* path, const char* interval)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_SAVE;
+
+    wl_cfg->savefile = ap_server_root_relative(cmd->pool, path);
+    if (wl_cfg->savefile == NULL)
+        return apr_psprintf(cmd->pool, "WLCacheSnapshot: invalid path %s", path);
+
+    wl_cfg->saveinterval = interval != NULL ? atoi(interval) : WL_SAVE_INTERVAL;
+    if (wl_cfg->saveinterval < 0)
+        return "WLCacheSnapshot takes a file and optionally the seconds between snapshots";
+
+    return NULL;
+}
+
+/** 
+ * log entry counts and memory of every
+ * list when they are loaded at startup
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_report(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_REPORT;
+
+    if (!strcasecmp(arg, "on"))
+            wl_cfg->report = 1;
+    else
+            wl_cfg->report = 0;
+
+    return NULL;
+}
+
+/**
+ * the WLBotRanges / WLBotDomains entry of a bot,
+ * created on first use
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param wl_cfg -> configuration structure
+ * @param bot -> WLBot value
+ */
+static struct wl_bot_info* wl_bot_info_get(cmd_parms* cmd, wl_config* wl_cfg, const char* bot)
+{
+    struct wl_bot_info* r;
+    char* name = apr_pstrdup(cmd->pool, bot);
+
+    /* compared with WLBot values, which lose their spaces */
+    wl_strip_ip(name, " ");
+    wl_cfg->set |= WL_SET_BOTINFO;
+
+    for (r = wl_cfg->botinfo; r != NULL; r = r->next) {
+        if (strcmp(r->bot, name) == 0)
+            return r;
+    }
+
+    r = apr_pcalloc(cmd->pool, sizeof(struct wl_bot_info));
+    r->bot = name;
+    r->next = wl_cfg->botinfo;
+    wl_cfg->botinfo = r;
+
+    return r;
+}
+
+/**
+ * load the crawler ranges a bot publishes. a
+ * request claiming the bot from inside them is
+ * verified without DNS. the file is a JSON range
+ * list as published by the search engine or one
+ * address / CIDR per line
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param bot -> WLBot value the ranges belong to
+ * @param path -> range file
+ */
+const char* wl_set_bot_ranges(cmd_parms* cmd, void* cfg, const char* bot, const char* path)
+{
+    struct wl_bot_info* r = wl_bot_info_get(cmd, (wl_config*) cfg, bot);
+
+    r->path = ap_server_root_relative(cmd->pool, path);
+    if (r->path == NULL)
+        return apr_pstrcat(cmd->pool, "WLBotRanges: invalid path ", path, NULL);
+
+    return NULL;
+}
+
+/**
+ * the host name suffixes a bot's crawlers resolve
+ * to, e.g. WLBotDomains Googlebot googlebot.com
+ * google.com. a PTR name outside them fails
+ * verification without a forward lookup
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param bot -> WLBot value the domains belong to
+ * @param suffix -> one allowed suffix
+ */
+const char* wl_set_bot_domains(cmd_parms* cmd, void* cfg, const char* bot, const char* suffix)
+{
+    struct wl_bot_info* r = wl_bot_info_get(cmd, (wl_config*) cfg, bot);
+
+    if (r->suffixes == NULL)
+        r->suffixes = apr_array_make(cmd->pool, 4, sizeof(const char*));
+    APR_ARRAY_PUSH(r->suffixes, const char*) = apr_pstrdup(cmd->pool, suffix);
+
+    return NULL;
+}
+
+/**
+ * false positive rate of the filters put in front
+ * of large lists, and how many entries a list needs
+ * to get one. Off for none
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param rate -> rate between 0 and 1, or Off
+ * @param min -> entries a list needs to be filtered
+ */
+const char* wl_set_list_filter(cmd_parms* cmd, void* cfg, const char* rate, const char* min)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    char* end;
+
+    wl_cfg->set |= WL_SET_FILTER;
+
+    if (!strcasecmp(rate, "off")) {
+        wl_cfg->filterrate = 0;
+        return NULL;
+    }
+
+    wl_cfg->filterrate = strtod(rate, &end);
+    if (*end != '\0' || wl_cfg->filterrate <= 0 || wl_cfg->filterrate >= 1)
+        return "WLListFilter takes a false positive rate between 0 and 1 or Off, and optionally the entries a list needs";
+
+    wl_cfg->filtermin = min != NULL ? atoi(min) : WL_FILTER_MIN;
+    if (wl_cfg->filtermin < 0)
+        return "WLListFilter takes a false positive rate between 0 and 1 or Off, and optionally the entries a list needs";
+
+    return NULL;
+}
+
+/**
+ * seconds between checks of the WLBotRanges
+ * files for changes. 0 only loads them on start
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_ranges_refresh(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_REFRESH;
+
+    wl_cfg->rangesrefresh = atoi(arg);
+    if (wl_cfg->rangesrefresh < 0)
+        return "WLBotRangesRefresh takes a number of seconds";
+
+    return NULL;
+}
+
+/** 
+ * set how many seconds verified, failed and
+ * DNS error verdicts are cached for
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param ok -> seconds for verified addresses
+ * @param fail -> seconds for failed addresses
+ * @param dnserr -> seconds for DNS errors (optional)
+ */
+const char* wl_set_cache_ttl(cmd_parms* cmd, void* cfg, const char* ok, const char* fail, const char* dnserr)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_TTL;
+
+    wl_cfg->ttl[WL_VERDICT_OK] = atoi(ok);
+    wl_cfg->ttl[WL_VERDICT_FAIL] = atoi(fail);
+    if (dnserr != NULL)
+        wl_cfg->ttl[WL_VERDICT_DNSERR] = atoi(dnserr);
+
+    if (wl_cfg->ttl[WL_VERDICT_OK] < 0 || wl_cfg->ttl[WL_VERDICT_FAIL] < 0 || wl_cfg->ttl[WL_VERDICT_DNSERR] < 0)
+        return "WLCacheTTL takes seconds for verified, failed and optionally DNS error verdicts";
+
+    return NULL;
+}
+
+/** 
+ * set how many verifications may wait on DNS at
+ * once, in each child and in the whole server.
+ * 0 for no limit
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param child -> limit per child
+ * @param server -> limit for all children (optional)
+ */
+const char* wl_set_dns_max(cmd_parms* cmd, void* cfg, const char* child, const char* server)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_DNS_MAX;
+
+    wl_cfg->dnsmax[0] = atoi(child);
+    if (server != NULL)
+        wl_cfg->dnsmax[1] = atoi(server);
+
+    if (wl_cfg->dnsmax[0] < 0 || wl_cfg->dnsmax[1] < 0)
+        return "WLDnsMaxInFlight takes a limit per child and optionally one for the server, 0 for none";
+
+    return NULL;
+}
+
+/** 
+ * set what happens to a bot that can't be verified
+ * because DNS is at its limit or unhealthy: Open
+ * lets it pass, Closed fails it
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param arg -> config set value
+ */
+const char* wl_set_dns_overload(cmd_parms* cmd, void* cfg, const char* arg)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_OVERLOAD;
+
+    if (!strcasecmp(arg, "open"))
+            wl_cfg->dnsfailopen = 1;
+    else if (!strcasecmp(arg, "closed"))
+            wl_cfg->dnsfailopen = 0;
+    else
+            return "WLDnsOverload takes Open or Closed";
+
+    return NULL;
+}
+
+/** 
+ * set when DNS counts as unhealthy: the percent of
+ * bad lookups in a window that opens the breaker
+ * (0 disables it), the seconds before it probes
+ * and the milliseconds past which a verification
+ * is bad (default WLDnsTimeout)
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param bad -> percent of bad lookups
+ * @param cooldown -> seconds open
+ * @param slow -> milliseconds (optional)
+ */
+const char* wl_set_dns_breaker(cmd_parms* cmd, void* cfg, const char* bad, const char* cooldown, const char* slow)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_BREAKER;
+
+    wl_cfg->breaker[0] = atoi(bad);
+    wl_cfg->breaker[1] = cooldown != NULL ? atoi(cooldown) : WL_BREAKER_COOLDOWN;
+    wl_cfg->breaker[2] = slow != NULL ? atoi(slow) : 0;
+
+    if (wl_cfg->breaker[0] < 0 || wl_cfg->breaker[0] > 100 || wl_cfg->breaker[1] <= 0 || wl_cfg->breaker[2] < 0)
+        return "WLDnsBreaker takes the percent of bad lookups (0 for off), seconds open and optionally slow milliseconds";
+
+    return NULL;
+}
+
+/** 
+ * set whether a new address is verified before its
+ * request is served (Inline) or while it is, by a
+ * background thread (Background). with a budget, only
+ * that many of its requests pass before the rest wait
+ * for the verdict
+ *
+ * @param cmd -> configuration inherit from httpd.conf
+ * @param cfg -> configuration structure
+ * @param mode -> Inline or Background
+ * @param budget -> requests passed unverified (optional)
+ */
+const char* wl_set_verify_mode(cmd_parms* cmd, void* cfg, const char* mode, const char* budget)
+{
+    wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_VERIFY;
+
+    if (!strcasecmp(mode, "inline"))
+            wl_cfg->verifymode = WL_VERIFY_INLINE;
+    else if (!strcasecmp(mode, "background"))
+            wl_cfg->verifymode = WL_VERIFY_BACKGROUND;
     else
-            wl_cfg->enabled = 0;
+            return "WLVerifyMode takes Inline or Background and optionally a request budget";
+
+    wl_cfg->verifybudget = budget != NULL ? atoi(budget) : 0;
+    if (wl_cfg->verifybudget < 0)
+        return "WLVerifyMode takes Inline or Background and optionally a request budget";
 
     return NULL;
 }
 
-/**
- * directive enables white lists
- * 
+/** 
+ * set how often queued list appends are
+ * written out
+ *
  * @param cmd -> configuration inherit from httpd.conf
  * @param cfg -> configuration structure
- * @param arg -> config set value
+ * @param arg -> milliseconds
  */
-const char* wl_set_enabled_list(cmd_parms* cmd, void* cfg, const char* arg)
+const char* wl_set_flush_interval(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_FLUSH_INTERVAL;
 
-    if (!strcasecmp(arg, "on"))
-            wl_cfg->lenabled = 1;
-    else
-            wl_cfg->lenabled = 0;
+    if ((wl_cfg->flushinterval = atoi(arg)) <= 0)
+        return "WLAppendFlushInterval takes milliseconds";
 
     return NULL;
 }
 
-/**
- * sets the bot(s) wl will be using
- * acceptable values are any user agent substring
- * this option can be given in a "|" delimited
- * string. ex:
- * Googlebot/2.1 | bingbot/2.1 | Yahoo Slurp!
- * or
- * Googlebot
+/** 
+ * set how many queued list appends are
+ * written at once
  *
  * @param cmd -> configuration inherit from httpd.conf
  * @param cfg -> configuration structure
- * @param arg -> config set value
+ * @param arg -> entries per batch
  */
-const char* wl_set_bot(cmd_parms* cmd, void* cfg, const char* args)
+const char* wl_set_flush_batch(cmd_parms* cmd, void* cfg, const char* arg)
 {
-    char* bots;
     wl_config* wl_cfg = (wl_config*) cfg;
-    bots = ap_getword_conf(cmd->pool, &args);
-
-    wl_strip_ip(bots, " "); 
-    wl_cfg->bot = bots;
-
-    char delims[] = "|";
-    char* piece = NULL;
-
-    piece = strtok(bots, delims);
-
-    while (piece != NULL) {
-        if (!strcasecmp(piece, "any")) {
-            wl_cfg->btany = 1;
-        }
+    wl_cfg->set |= WL_SET_FLUSH_BATCH;
 
-        wl_cfg->cbot = (bitem*) wl_xmalloc(sizeof(bitem));
-        wl_cfg->cbot->name = piece;
-        wl_cfg->cbot->next = wl_cfg->chead;
-        wl_cfg->chead = wl_cfg->cbot;
-        piece = strtok(NULL, delims);
-    }
+    wl_cfg->flushbatch = atoi(arg);
+    if (wl_cfg->flushbatch <= 0 || wl_cfg->flushbatch > 65536)
+        return "WLAppendBatchSize takes a number of entries between 1 and 65536";
 
     return NULL;
 }
 
-
 /** 
- * set the timeout for forward and reverse DNS
- * lookups
+ * set when list appends are fsynced: Off,
+ * Batch (once per batch) or Always (every entry)
  *
  * @param cmd -> configuration inherit from httpd.conf
  * @param cfg -> configuration structure
  * @param arg -> config set value
  */
-const char* wl_set_dns_timeout(cmd_parms* cmd, void* cfg, const char* arg)
+const char* wl_set_flush_sync(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
-
-    if (!strcasecmp(arg, "on"))
-            wl_cfg->dnstimeout = 1;
+    wl_cfg->set |= WL_SET_FLUSH_SYNC;
+
+    if (!strcasecmp(arg, "off"))
+            wl_cfg->flushsync = WL_FSYNC_OFF;
+    else if (!strcasecmp(arg, "batch"))
+            wl_cfg->flushsync = WL_FSYNC_BATCH;
+    else if (!strcasecmp(arg, "always"))
+            wl_cfg->flushsync = WL_FSYNC_ALWAYS;
     else
-            wl_cfg->dnstimeout = 0;
+            return "WLAppendFsync takes Off, Batch or Always";
 
     return NULL;
 }
@@ -905,6 +4428,7 @@ const char* wl_set_dns_timeout(cmd_parms* cmd, void* cfg, const char* arg)
 const char* wl_set_subprocess_env(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_SPENV;
 
     if (!strcasecmp(arg, "on"))
             wl_cfg->spenv = 1;
@@ -926,6 +4450,7 @@ const char* wl_set_subprocess_env(cmd_parms* cmd, void* cfg, const char* arg)
 const char* wl_set_bot_auto_add(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_BOT_AUTO;
 
     if (!strcasecmp(arg, "on"))
             wl_cfg->btauto = 1;
@@ -946,6 +4471,7 @@ const char* wl_set_bot_auto_add(cmd_parms* cmd, void* cfg, const char* arg)
 const char* wl_set_bot_list(cmd_parms* cmd, void* cfg, const char* args)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_BOTS;
     wl_cfg->btlist = (char*) args;
 
     return NULL;
@@ -961,6 +4487,7 @@ const char* wl_set_bot_list(cmd_parms* cmd, void* cfg, const char* args)
 const char* wl_set_list(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_LIST;
     wl_cfg->list = (char*) arg;
 
     return NULL;
@@ -976,6 +4503,7 @@ const char* wl_set_list(cmd_parms* cmd, void* cfg, const char* arg)
 const char* wl_set_list_append(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_LIST_APPEND;
     if (!strcasecmp(arg, "on")) {
             wl_cfg->listappend = 1;
     } else {
@@ -996,6 +4524,7 @@ const char* wl_set_list_append(cmd_parms* cmd, void* cfg, const char* arg)
 const char* wl_set_blist(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_BLIST;
     wl_cfg->blist = (char*) arg;
 
     return NULL;
@@ -1011,6 +4540,7 @@ const char* wl_set_blist(cmd_parms* cmd, void* cfg, const char* arg)
 const char* wl_set_blist_append(cmd_parms* cmd, void* cfg, const char* arg)
 {
     wl_config* wl_cfg = (wl_config*) cfg;
+    wl_cfg->set |= WL_SET_BLIST_APPEND;
     if (!strcasecmp(arg, "on")) {
             wl_cfg->blistappend = 1;
     } else {
@@ -1023,6 +4553,685 @@ const char* wl_set_blist_append(cmd_parms* cmd, void* cfg, const char* arg)
 
 
 
+/**
+ * write queued lines to one list file. the lock
+ * is taken blocking, so children queue up behind
+ * each other instead of dropping entries
+ *
+ * @param pool -> pool for the file
+ * @param s -> server for logging
+ * @param path -> list file
+ * @param buf -> lines to append
+ * @param len -> length of buf
+ * @param sync -> fsync before unlocking
+ */
+static void wl_writer_write(apr_pool_t* pool, server_rec* s, const char* path, const char* buf, apr_size_t len, int sync)
+{
+    apr_file_t* file;
+    apr_status_t st;
+
+    st = apr_file_open(&file, path,
+                       APR_FOPEN_WRITE | APR_FOPEN_CREATE | APR_FOPEN_APPEND,
+                       APR_FPROT_UREAD | APR_FPROT_UWRITE | APR_FPROT_GREAD,
+                       pool);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] couldn't open list file %s", path);
+        return;
+    }
+
+    st = apr_file_lock(file, APR_FLOCK_EXCLUSIVE);
+    if (st == APR_SUCCESS) {
+        st = apr_file_write_full(file, buf, len, NULL);
+        if (st == APR_SUCCESS && sync)
+            st = apr_file_sync(file);
+        apr_file_unlock(file);
+    }
+    if (st != APR_SUCCESS)
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] couldn't append to list file %s", path);
+
+    apr_file_close(file);
+}
+
+/**
+ * write one batch, grouping lines that go
+ * to the same file into a single write
+ *
+ * @param w -> writer
+ * @param batch -> entries taken off the queue
+ * @param n -> number of entries
+ */
+static void wl_writer_flush(struct wl_writer* w, struct wl_pending* batch, int n)
+{
+    char* buf;
+    apr_size_t len, l;
+    int i, j;
+
+    buf = apr_palloc(w->pool, n * sizeof(batch->line));
+
+    for (i = 0; i < n; i++) {
+        if (batch[i].path == NULL)
+            continue;
+
+        len = 0;
+        for (j = i; j < n; j++) {
+            if (batch[j].path == NULL || strcmp(batch[j].path, batch[i].path) != 0)
+                continue;
+
+            l = strlen(batch[j].line);
+            if (w->fsync == WL_FSYNC_ALWAYS) {
+                wl_writer_write(w->pool, w->s, batch[i].path, batch[j].line, l, 1);
+            } else {
+                memcpy(buf + len, batch[j].line, l);
+                len += l;
+            }
+            if (j != i)
+                batch[j].path = NULL;
+        }
+
+        if (len > 0)
+            wl_writer_write(w->pool, w->s, batch[i].path, buf, len, w->fsync == WL_FSYNC_BATCH);
+        batch[i].path = NULL;
+    }
+
+    apr_pool_clear(w->pool);
+}
+
+/**
+ * background thread draining the append queue
+ * every flush interval or whenever a full batch
+ * is waiting
+ *
+ * @param thread -> this thread
+ * @param data -> writer
+ */
+static void* APR_THREAD_FUNC wl_writer_main(apr_thread_t* thread, void* data)
+{
+    struct wl_writer* w = data;
+    bitem* bots;
+    int n, stop;
+
+    apr_thread_mutex_lock(w->lock);
+    for (;;) {
+        if (w->count < w->batch && !w->stop)
+            apr_thread_cond_timedwait(w->wake, w->lock, apr_time_from_msec(w->interval));
+
+        for (n = 0; w->count > 0; n++) {
+            w->out[n] = w->queue[w->head];
+            w->head = (w->head + 1) % w->size;
+            w->count--;
+        }
+        bots = w->bots;
+        w->bots = NULL;
+        w->nbots = 0;
+        stop = w->stop && w->count == 0;
+        apr_thread_mutex_unlock(w->lock);
+
+        if (n > 0)
+            wl_writer_flush(w, w->out, n);
+        if (stop) {
+            wl_bots_free(bots);
+            break;
+        }
+
+        if (bots != NULL) {
+            wl_bots_adopt(w->s, w->pool, bots);
+            apr_pool_clear(w->pool);
+        }
+        wl_ranges_follow(w);
+
+        apr_thread_mutex_lock(w->lock);
+    }
+
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+/**
+ * flush what is left and stop the writer
+ * when the child exits
+ *
+ * @param data -> writer
+ */
+static apr_status_t wl_writer_stop(void* data)
+{
+    struct wl_writer* w = data;
+    apr_status_t st;
+
+    apr_thread_mutex_lock(w->lock);
+    w->stop = 1;
+    apr_thread_cond_signal(w->wake);
+    apr_thread_mutex_unlock(w->lock);
+
+    apr_thread_join(&st, w->thread);
+    w->thread = NULL;
+
+    if (w->overflow > 0)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, w->s, "[" WL_MODULE_LOG_ID "] %d list appends were written inline because the queue was full", w->overflow);
+
+    return APR_SUCCESS;
+}
+
+/**
+ * start the append writer for this child
+ *
+ * @param pool -> child pool
+ * @param s -> main server
+ * @param cfg -> main server config
+ */
+static void wl_writer_start(apr_pool_t* pool, server_rec* s, wl_config* cfg)
+{
+    struct wl_writer* w = &wl_writer;
+    apr_status_t st;
+
+    w->s = s;
+    w->batch = cfg->flushbatch > 0 ? cfg->flushbatch : WL_WRITER_BATCH;
+    w->interval = cfg->flushinterval > 0 ? cfg->flushinterval : WL_WRITER_INTERVAL;
+    w->fsync = cfg->flushsync;
+    w->ranges = 0;
+    w->bots = NULL;
+    w->nbots = 0;
+    w->size = w->batch * 4 > WL_WRITER_QUEUE ? w->batch * 4 : WL_WRITER_QUEUE;
+    w->head = w->count = w->stop = w->overflow = 0;
+    w->queue = apr_palloc(pool, w->size * sizeof(struct wl_pending));
+    w->out = apr_palloc(pool, w->size * sizeof(struct wl_pending));
+
+#if APR_HAS_THREADS
+    if ((st = apr_pool_create(&w->pool, pool)) == APR_SUCCESS
+        && (st = apr_thread_mutex_create(&w->lock, APR_THREAD_MUTEX_DEFAULT, pool)) == APR_SUCCESS
+        && (st = apr_thread_cond_create(&w->wake, pool)) == APR_SUCCESS
+        && (st = apr_thread_create(&w->thread, NULL, wl_writer_main, w, pool)) == APR_SUCCESS) {
+        /* before the sub pool goes away */
+        apr_pool_pre_cleanup_register(pool, w, wl_writer_stop);
+        return;
+    }
+    ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] could not start the list writer, appending inline");
+#endif
+    w->thread = NULL;
+}
+
+/**
+ * verify an address for the background checkers,
+ * store the verdict like wl_init does and free its
+ * in-flight slot for the requests waiting on it
+ *
+ * @param k -> checker
+ * @param c -> verification
+ * @param pool -> scratch pool
+ */
+static void wl_checker_run(struct wl_checker* k, struct wl_check* c, apr_pool_t* pool)
+{
+    wl_config* wl_cfg = c->cfg;
+    wl_dns_multi dns;
+    struct wl_addr fwd;
+    apr_time_t start;
+    int dns_st, probe, shed, verdict;
+
+    shed = wl_dns_admit(k->s, wl_cfg, &probe);
+    if (shed != WL_SHED_NONE) {
+        wl_stat_inc(shed == WL_SHED_BREAKER ? WL_STAT_SHED_BREAKER : WL_STAT_SHED_BUSY);
+        /* the requests past the budget get the answer of a
+         * DNS error instead of all verifying inline */
+        wl_store_put(&c->client, WL_VERDICT_DNSERR, wl_cfg->ttl[WL_VERDICT_DNSERR], 0);
+        wl_flight_release(c->flight, c->token);
+        return;
+    }
+
+    start = apr_time_now();
+    dns_st = wl_dns_verify(pool, wl_dns_timeout(wl_cfg), &c->client, c->info != NULL ? c->info->domains : NULL, &dns);
+    wl_dns_release(k->s, wl_cfg, probe, dns_st, apr_time_now() - start);
+
+    if (dns_st != WL_DNS_OK)
+        verdict = dns_st == WL_DNS_NOTFOUND ? WL_VERDICT_FAIL : WL_VERDICT_DNSERR;
+    else if (wl_create_addr(dns.wl_dns_forward, &fwd) != 0 || !wl_addr_same(&c->client, &fwd))
+        verdict = WL_VERDICT_FAIL;
+    else
+        verdict = WL_VERDICT_OK;
+
+    wl_store_put(&c->client, verdict, wl_cfg->ttl[verdict], c->info != NULL ? c->info->tag : 0);
+    if (verdict == WL_VERDICT_OK) {
+        wl_stat_inc(WL_STAT_VERIFY_OK);
+        if (wl_earned_listable(c->info))
+            wl_append_list(wl_cfg, wl_cfg->list, c->ip, k->s, pool, 0);
+    } else if (verdict == WL_VERDICT_FAIL) {
+        wl_stat_inc(WL_STAT_VERIFY_FAIL);
+        wl_append_list(wl_cfg, wl_cfg->blist, c->ip, k->s, pool, 1);
+    }
+
+    wl_flight_release(c->flight, c->token);
+}
+
+/**
+ * background thread running queued verifications
+ *
+ * @param thread -> this thread
+ * @param data -> checker
+ */
+static void* APR_THREAD_FUNC wl_checker_main(apr_thread_t* thread, void* data)
+{
+    struct wl_checker* k = data;
+    struct wl_check c;
+    apr_pool_t* pool;
+
+    /* the thread's own pool is only touched by it */
+    if (apr_pool_create(&pool, apr_thread_pool_get(thread)) != APR_SUCCESS) {
+        apr_thread_exit(thread, APR_EGENERAL);
+        return NULL;
+    }
+
+    apr_thread_mutex_lock(k->lock);
+    for (;;) {
+        while (k->count == 0 && !k->stop)
+            apr_thread_cond_wait(k->wake, k->lock);
+        if (k->count == 0)
+            break;
+
+        c = k->queue[k->head];
+        k->head = (k->head + 1) % k->size;
+        k->count--;
+        apr_thread_mutex_unlock(k->lock);
+
+        /* a stopping child still frees the slot for the waiters */
+        if (k->stop)
+            wl_flight_release(c.flight, c.token);
+        else
+            wl_checker_run(k, &c, pool);
+        apr_pool_clear(pool);
+
+        apr_thread_mutex_lock(k->lock);
+    }
+    apr_thread_mutex_unlock(k->lock);
+
+    apr_pool_destroy(pool);
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+/**
+ * stop the checkers when the child exits
+ *
+ * @param data -> checker
+ */
+static apr_status_t wl_checker_stop(void* data)
+{
+    struct wl_checker* k = data;
+    apr_status_t st;
+    int i;
+
+    apr_thread_mutex_lock(k->lock);
+    k->stop = 1;
+    apr_thread_cond_broadcast(k->wake);
+    apr_thread_mutex_unlock(k->lock);
+
+    for (i = 0; i < k->nthreads; i++)
+        apr_thread_join(&st, k->threads[i]);
+    k->nthreads = 0;
+
+    return APR_SUCCESS;
+}
+
+/**
+ * start the background checkers of this child when
+ * any server uses WLVerifyMode Background
+ *
+ * @param pool -> child pool
+ * @param s -> main server
+ */
+static void wl_checker_start(apr_pool_t* pool, server_rec* s)
+{
+    struct wl_checker* k = &wl_checker;
+    wl_config* cfg;
+    server_rec* sv;
+    apr_status_t st = APR_SUCCESS;
+    int used = 0;
+
+    for (sv = s; sv != NULL; sv = sv->next) {
+        cfg = (wl_config*) ap_get_module_config(sv->lookup_defaults, &wl_module);
+        if (cfg->verifymode == WL_VERIFY_BACKGROUND)
+            used = 1;
+    }
+
+    k->nthreads = 0;
+    if (!used)
+        return;
+
+    k->s = s;
+    k->size = WL_CHECKER_QUEUE;
+    k->head = k->count = k->stop = 0;
+    k->queue = apr_palloc(pool, k->size * sizeof(struct wl_check));
+
+#if APR_HAS_THREADS
+    if ((st = apr_thread_mutex_create(&k->lock, APR_THREAD_MUTEX_DEFAULT, pool)) == APR_SUCCESS
+        && (st = apr_thread_cond_create(&k->wake, pool)) == APR_SUCCESS) {
+        while (k->nthreads < WL_CHECKER_THREADS
+               && (st = apr_thread_create(&k->threads[k->nthreads], NULL, wl_checker_main, k, pool)) == APR_SUCCESS)
+            k->nthreads++;
+        if (k->nthreads > 0) {
+            apr_pool_pre_cleanup_register(pool, k, wl_checker_stop);
+            return;
+        }
+    }
+#endif
+    ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] could not start the background checkers, verifying inline");
+}
+
+/**
+ * hand the verification of a request's address to the
+ * background checkers, with the in-flight slot the
+ * request leads. returns 0 when they are not running
+ * or behind, the request then verifies inline
+ *
+ * @param rec -> Apache 2 request
+ * @param wl_cfg -> module config of the request
+ * @param client -> client address
+ * @param ip -> client address as text
+ * @param info -> bot info of the claimed bot, NULL for none
+ * @param flight -> slot the request leads
+ */
+static int wl_checker_queue(request_rec* rec, wl_config* wl_cfg, const addr* client, const char* ip, const struct wl_bot_info* info, struct wl_flight* flight)
+{
+    struct wl_checker* k = &wl_checker;
+    struct wl_check* c;
+
+    if (k->nthreads == 0)
+        return 0;
+
+    apr_thread_mutex_lock(k->lock);
+    if (k->count == k->size || k->stop) {
+        apr_thread_mutex_unlock(k->lock);
+        wl_stat_inc(WL_STAT_CHECKS_DROPPED);
+        return 0;
+    }
+
+    c = &k->queue[(k->head + k->count) % k->size];
+    c->client = *client;
+    c->cfg = wl_cfg;
+    c->info = info;
+    c->flight = flight;
+    c->token = wl_flight_token;
+    apr_cpystrn(c->ip, ip, sizeof(c->ip));
+    k->count++;
+    apr_thread_cond_signal(k->wake);
+    apr_thread_mutex_unlock(k->lock);
+
+    /* the checker frees the slot now, not wl_close */
+    wl_flight_mine = NULL;
+    wl_stat_inc(WL_STAT_CHECKS_QUEUED);
+    return 1;
+}
+
+/**
+ * runs in the parent once the configuration
+ * is read, before any child is forked
+ *
+ * @param pconf -> configuration pool
+ * @param plog -> log pool
+ * @param ptemp -> temporary pool
+ * @param s -> main server
+ */
+static int wl_post_config(apr_pool_t* pconf, apr_pool_t* plog, apr_pool_t* ptemp, server_rec* s)
+{
+    wl_config* cfg = (wl_config*) ap_get_module_config(s->lookup_defaults, &wl_module);
+
+    void* data = NULL;
+    const char* key = "wl_post_config";
+    int daemons, threads;
+
+    wl_dns_load_servers(ptemp, s, cfg->dnsserver);
+    if (wl_dns_nns == 0)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, "[" WL_MODULE_LOG_ID "] no nameserver configured, DNS verification will fail");
+
+    /* the first pass only checks the configuration */
+    apr_pool_userdata_get(&data, key, s->process->pool);
+    if (data == NULL) {
+        apr_pool_userdata_set((const void*) 1, key, apr_pool_cleanup_null, s->process->pool);
+        return OK;
+    }
+
+    /* a counter slot for every request thread the MPM may
+     * run, and the checkers and writer of each child */
+    if (ap_mpm_query(AP_MPMQ_HARD_LIMIT_DAEMONS, &daemons) != APR_SUCCESS || daemons < 1
+        || ap_mpm_query(AP_MPMQ_HARD_LIMIT_THREADS, &threads) != APR_SUCCESS || threads < 1) {
+        daemons = WL_STATS_SLOTS;
+        threads = 1;
+    }
+
+    wl_store_create(pconf, s, cfg->nslots > 0 ? cfg->nslots : WL_STORE_SLOTS, daemons * (threads + WL_CHECKER_THREADS + 1));
+
+    /* the verdicts of the last generation, saved as it ended */
+    wl_save_file = cfg->savefile[0] != '\0' ? cfg->savefile : NULL;
+    wl_save_every = apr_time_from_sec(cfg->saveinterval);
+    wl_save_next = apr_time_now() + wl_save_every;
+    wl_save_pid = getpid();
+    wl_ranges_every = apr_time_from_sec(cfg->rangesrefresh);
+    wl_ranges_next = apr_time_now() + wl_ranges_every;
+    if (wl_save_file != NULL) {
+        wl_store_restore(ptemp, s, wl_save_file, cfg->ttl);
+        apr_pool_cleanup_register(pconf, s, wl_store_save_cleanup, apr_pool_cleanup_null);
+    }
+
+    wl_preload(pconf, ptemp, s);
+
+    return OK;
+}
+
+/**
+ * attach the child to the shared verdict table
+ * and start its list writer
+ *
+ * @param pool -> child pool
+ * @param s -> main server
+ */
+static void wl_child_init(apr_pool_t* pool, server_rec* s)
+{
+    apr_status_t st;
+
+#if APR_HAS_THREADS
+    /* serializes snapshot writers, readers never take it.
+     * before any thread of the child can publish */
+    wl_rcu_child = 1;
+    st = apr_thread_mutex_create(&wl_rcu_lock, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (st == APR_SUCCESS)
+        st = apr_thread_mutex_create(&wl_rcu_grace, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] could not create the bot snapshot lock, not adding bots");
+        wl_rcu_lock = NULL;
+        wl_rcu_grace = NULL;
+    }
+#endif
+
+    wl_writer_start(pool, s, (wl_config*) ap_get_module_config(s->lookup_defaults, &wl_module));
+    wl_checker_start(pool, s);
+
+    if (wl_shm_file == NULL)
+        return;
+
+    st = apr_shm_attach(&wl_shm, wl_shm_file, pool);
+    if (st != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, st, s, "[" WL_MODULE_LOG_ID "] could not attach shared verdict table %s", wl_shm_file);
+        wl_store = NULL;
+        wl_stats_locate();
+        return;
+    }
+
+    wl_store = apr_shm_baseaddr_get(wl_shm);
+    wl_stats_locate();
+}
+
+#if WL_MODULE_COUNT_ALLOCS
+/**
+ * wl_init/1 reporting the heap allocations it
+ * made in MODWL_ALLOCS, e.g. for %{MODWL_ALLOCS}e
+ * in a LogFormat. a list or verdict hit makes none
+ *
+ * @param rec -> Apache 2 request
+ */
+static int wl_init_counted(request_rec* rec)
+{
+    unsigned long before = wl_allocs;
+    int status = wl_init(rec);
+
+    apr_table_setn(rec->subprocess_env, "MODWL_ALLOCS", apr_ltoa(rec->pool, (long) (wl_allocs - before)));
+    AP_LOG_DEBUG(rec, "wl_init made %lu heap allocations", wl_allocs - before);
+
+    return status;
+}
+#endif
+
+/**
+ * SetHandler wl-status: the counters of every
+ * request thread summed, list sizes, verdict table
+ * occupancy and DNS latency histograms. plain
+ * "Key: value" lines like mod_status ?auto, JSON
+ * with ?json
+ *
+ * @param rec -> Apache 2 request
+ */
+static int wl_status_handler(request_rec* rec)
+{
+    static const trie empty = WL_TRIE_INIT;
+    wl_config* wl_cfg;
+    const struct wl_list* l;
+    const trie* wlt = &empty;
+    const trie* blt = &empty;
+    apr_size_t wlf = 0, blf = 0;
+    const struct wl_snapshot* snap;
+    const struct wl_stat_slot* slot;
+    const bitem* bot;
+    apr_uint64_t count[WL_STAT_MAX];
+    apr_uint64_t dns[2][WL_STATS_BUCKETS];
+    apr_uint64_t dns_us[2];
+    apr_uint32_t verdicts[4] = { 0, 0, 0, 0 };
+    apr_uint32_t i, used = 0, lost = 0, nslots = 0, verdict, now, indns = 0, breaker = WL_BREAKER_CLOSED;
+    apr_uint32_t phase;
+    apr_time_t uptime = 0;
+    const char* sep;
+    int w, b, nbots = 0, nlists = 0, json;
+    static const char* which[2][2] = { { "DnsReverse", "reverse" }, { "DnsForward", "forward" } };
+
+    if (rec->handler == NULL || strcmp(rec->handler, WL_STATS_HANDLER))
+        return DECLINED;
+
+    if (rec->method_number != M_GET)
+        return DECLINED;
+
+    memset(count, 0, sizeof(count));
+    memset(dns, 0, sizeof(dns));
+    memset(dns_us, 0, sizeof(dns_us));
+
+    /* slots are written without locks, a sum may
+     * miss increments still in flight */
+    if (wl_stats != NULL) {
+        nslots = wl_stats->nslots;
+        lost = apr_atomic_read32(&wl_stats->lost);
+        uptime = apr_time_now() - wl_stats->started;
+        for (i = 0; i < nslots; i++) {
+            slot = &wl_stat_lines[i].slot;
+            if (apr_atomic_read32((volatile apr_uint32_t*) &slot->owner) == 0)
+                continue;
+            used++;
+            for (w = 0; w < WL_STAT_MAX; w++)
+                count[w] += slot->count[w];
+            for (w = 0; w < 2; w++) {
+                for (b = 0; b < WL_STATS_BUCKETS; b++)
+                    dns[w][b] += slot->dns[w][b];
+                dns_us[w] += slot->dns_us[w];
+            }
+        }
+    }
+
+    if (wl_store != NULL) {
+        now = (apr_uint32_t) apr_time_sec(apr_time_now());
+        for (i = 0; i < wl_store->nslots; i++) {
+            verdict = apr_atomic_read32(&wl_store->slots[i].verdict);
+            if (verdict != WL_VERDICT_NONE && verdict < 4 && wl_store->slots[i].expires > now)
+                verdicts[verdict]++;
+        }
+    }
+
+    if (wl_flights != NULL) {
+        indns = apr_atomic_read32(&wl_flights->busy);
+        breaker = apr_atomic_read32(&wl_flights->breaker.state);
+    }
+
+    /* the lists of the host serving the status */
+    wl_cfg = (wl_config*) ap_get_module_config(rec->per_dir_config, &wl_module);
+    if (wl_cfg->policy != NULL) {
+        if (wl_cfg->policy->list != NULL) {
+            wlt = &wl_cfg->policy->list->trie;
+            wlf = wl_cfg->policy->list->bloom.bytes;
+        }
+        if (wl_cfg->policy->blist != NULL) {
+            blt = &wl_cfg->policy->blist->trie;
+            blf = wl_cfg->policy->blist->bloom.bytes;
+        }
+    }
+    for (l = wl_lists; l != NULL; l = l->next)
+        nlists++;
+
+    phase = wl_rcu_enter();
+    snap = wl_cfg->bots->snap;
+    for (bot = snap != NULL ? snap->bots : NULL; bot != NULL; bot = bot->next)
+        nbots++;
+    wl_rcu_leave(phase);
+
+    json = rec->args != NULL && strstr(rec->args, "json") != NULL;
+    ap_set_content_type(rec, json ? "application/json" : "text/plain; charset=ISO-8859-1");
+    if (rec->header_only)
+        return OK;
+
+    if (json) {
+        ap_rprintf(rec, "{\n  \"uptime\": %" APR_TIME_T_FMT ",\n  \"counters\": {", apr_time_sec(uptime));
+        for (w = 0; w < WL_STAT_MAX; w++)
+            ap_rprintf(rec, "%s\n    \"%s\": %" APR_UINT64_T_FMT, w ? "," : "", wl_stat_names[w][1], count[w]);
+        ap_rprintf(rec, "\n  },\n  \"lists\": {\n    \"whitelist_entries\": %u,\n    \"whitelist_bytes\": %" APR_SIZE_T_FMT
+                   ",\n    \"whitelist_filter_bytes\": %" APR_SIZE_T_FMT
+                   ",\n    \"blacklist_entries\": %u,\n    \"blacklist_bytes\": %" APR_SIZE_T_FMT
+                   ",\n    \"blacklist_filter_bytes\": %" APR_SIZE_T_FMT ",\n    \"bots\": %d,\n    \"files\": %d\n  },",
+                   wlt->entries, (apr_size_t) wl_trie_bytes(wlt), wlf,
+                   blt->entries, (apr_size_t) wl_trie_bytes(blt), blf, nbots, nlists);
+        ap_rprintf(rec, "\n  \"verdicts\": {\n    \"slots\": %u,\n    \"pass\": %u,\n    \"fail\": %u,\n    \"dns_error\": %u\n  },",
+                   wl_store != NULL ? wl_store->nslots : 0, verdicts[WL_VERDICT_OK], verdicts[WL_VERDICT_FAIL],
+                   verdicts[WL_VERDICT_DNSERR]);
+        ap_rprintf(rec, "\n  \"counter_slots\": {\n    \"total\": %u,\n    \"used\": %u,\n    \"lost\": %u\n  },", nslots, used, lost);
+        ap_rprintf(rec, "\n  \"dns\": {\n    \"in_flight\": %u,\n    \"breaker\": \"%s\"\n  },", indns, wl_breaker_names[breaker % 3]);
+        ap_rputs("\n  \"dns_latency\": {\n    \"bounds_us\": [", rec);
+        for (b = 0; b < WL_STATS_BUCKETS - 1; b++)
+            ap_rprintf(rec, "%s%u", b ? ", " : "", wl_stat_bounds[b]);
+        ap_rputs("]", rec);
+        for (w = 0; w < 2; w++) {
+            ap_rprintf(rec, ",\n    \"%s\": {\"sum_us\": %" APR_UINT64_T_FMT ", \"buckets\": [", which[w][1], dns_us[w]);
+            for (b = 0; b < WL_STATS_BUCKETS; b++)
+                ap_rprintf(rec, "%s%" APR_UINT64_T_FMT, b ? ", " : "", dns[w][b]);
+            ap_rputs("]}", rec);
+        }
+        ap_rputs("\n  }\n}\n", rec);
+        return OK;
+    }
+
+    ap_rprintf(rec, "Uptime: %" APR_TIME_T_FMT "\n", apr_time_sec(uptime));
+    for (w = 0; w < WL_STAT_MAX; w++)
+        ap_rprintf(rec, "%s: %" APR_UINT64_T_FMT "\n", wl_stat_names[w][0], count[w]);
+    ap_rprintf(rec, "WhitelistEntries: %u\nWhitelistBytes: %" APR_SIZE_T_FMT "\nWhitelistFilterBytes: %" APR_SIZE_T_FMT "\n"
+               "BlacklistEntries: %u\nBlacklistBytes: %" APR_SIZE_T_FMT "\nBlacklistFilterBytes: %" APR_SIZE_T_FMT "\n"
+               "Bots: %d\nListFiles: %d\n",
+               wlt->entries, (apr_size_t) wl_trie_bytes(wlt), wlf,
+               blt->entries, (apr_size_t) wl_trie_bytes(blt), blf, nbots, nlists);
+    ap_rprintf(rec, "VerdictSlots: %u\nVerdictsPass: %u\nVerdictsFail: %u\nVerdictsDnsError: %u\n",
+               wl_store != NULL ? wl_store->nslots : 0, verdicts[WL_VERDICT_OK], verdicts[WL_VERDICT_FAIL],
+               verdicts[WL_VERDICT_DNSERR]);
+    ap_rprintf(rec, "CounterSlots: %u\nCounterSlotsUsed: %u\nCounterSlotsLost: %u\n", nslots, used, lost);
+    ap_rprintf(rec, "DnsInFlight: %u\nDnsBreaker: %s\n", indns, wl_breaker_names[breaker % 3]);
+    for (w = 0; w < 2; w++) {
+        ap_rprintf(rec, "%sUs: %" APR_UINT64_T_FMT "\n", which[w][0], dns_us[w]);
+        for (b = 0; b < WL_STATS_BUCKETS; b++) {
+            sep = b < WL_STATS_BUCKETS - 1 ? apr_psprintf(rec->pool, "%u", wl_stat_bounds[b]) : "Inf";
+            ap_rprintf(rec, "%sLe%s: %" APR_UINT64_T_FMT "\n", which[w][0], sep, dns[w][b]);
+        }
+    }
+
+    return OK;
+}
+
 /**
  * registers the hook in the Apache
  *
@@ -1030,65 +5239,85 @@ const char* wl_set_blist_append(cmd_parms* cmd, void* cfg, const char* arg)
  */
 static void wl_hooks(apr_pool_t* pool)
 {
+    ap_hook_post_config(wl_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(wl_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+#if AP_SERVER_MAJORVERSION_NUMBER >= 2 && AP_SERVER_MINORVERSION_NUMBER >= 4
+    ap_hook_monitor(wl_monitor, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
+    ap_hook_pre_connection(wl_pre_connection, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(wl_status_handler, NULL, NULL, APR_HOOK_MIDDLE);
+#if WL_MODULE_COUNT_ALLOCS
+    ap_hook_post_read_request(wl_init_counted, NULL, NULL, APR_HOOK_MIDDLE);
+#else
     ap_hook_post_read_request(wl_init, NULL, NULL, APR_HOOK_MIDDLE); // middle was present in initial version. 
+#endif
 }
 
 /**
- * open the whitelist file and append a
- * ip address.
+ * queue an ip address for the background
+ * writer to append to a list file. falls back
+ * to writing inline when threads are unavailable
+ * or the queue is full
  *
  * @param wl_cfg -> WL congi
  * @param fl -> file path
  * @param addr -> IPv4 address
- * @param rec -> Apache 2 request
+ * @param s -> server for the log
+ * @param pool -> pool of the caller
  */
-inline static void wl_append_list(wl_config* wl_cfg, char* fl, char* addr, request_rec* rec, int bt)
+inline static void wl_append_list(wl_config* wl_cfg, char* fl, const char* addr, server_rec* s, apr_pool_t* pool, int bt)
 {
-    apr_file_t* wl_file;
-    apr_status_t wl_file_st;
-    const char* new_line;
+    struct wl_writer* w = &wl_writer;
+    const struct wl_list* l = NULL;
+    struct wl_pending* pending;
+    char line[INET6_ADDRSTRLEN + 1];
+    int break_inline = 1;
 
     if (wl_can_append(wl_cfg, bt) != 1) {
-      AP_LOG_INFO(rec, "appending is disabled for list %s. not adding to file", fl);
+      AP_SLOG_DEBUG(s, "appending is disabled for list %s. not adding to file", fl);
       return;
     }
 
-    if (strcasecmp(fl, "") != 0) {
-	    wl_file_st = apr_file_open(&wl_file, 
-				       fl,
-              APR_FOPEN_WRITE | APR_FOPEN_CREATE | APR_FOPEN_APPEND,
-              APR_FPROT_UREAD | APR_FPROT_UWRITE | APR_FPROT_GREAD,
-				      rec->pool);
-	       
-
-            if (!(wl_file_st == APR_SUCCESS)) {
-              AP_LOG_INFO(rec, "Couldn't open list file %s", fl);
-		return;
-            }
-
-	    wl_file_st = apr_file_lock(wl_file, 
-				       APR_FLOCK_EXCLUSIVE | 
-				       APR_FLOCK_NONBLOCK);
-
-
-	    if (wl_file_st == APR_SUCCESS) {
-        new_line = wl_concat(addr, "\n");
-		    apr_file_puts(new_line, wl_file);
-		    apr_file_close(wl_file);
+    if (wl_cfg->policy != NULL)
+      l = bt == 1 ? wl_cfg->policy->blist : wl_cfg->policy->list;
+    if (l != NULL && l->trie.map != NULL) {
+      AP_SLOG_DEBUG(s, "list %s is a compiled index. not adding to file", fl);
+      return;
+    }
 
+    if (strcasecmp(fl, "") == 0) {
 #if WL_MODULE_DEBUG_MODE
-      AP_LOG_INFO(rec, "Whitelist added: %s", addr);
+      AP_SLOG_DEBUG(s, "Whitelist disabled not adding: %s to storage list", addr);
 #endif
-		    return;
-	    } 
+      return;
+    }
 
-            return;
-#if WL_MODULE_DEBUG_MODE
-      AP_LOG_INFO(rec, "Whitelist couldn't lock: %s, (status err): %d", addr, wl_file_st);
-#endif
+    if (w->thread != NULL) {
+      apr_thread_mutex_lock(w->lock);
+      if (w->count < w->size)
+        break_inline = 0;
+      else
+        w->overflow++;
+    }
+
+    /* no writer, or it is behind: write it ourselves rather than lose it */
+    if (break_inline) {
+      if (w->thread != NULL)
+        apr_thread_mutex_unlock(w->lock);
+      apr_snprintf(line, sizeof(line), "%s\n", addr);
+      wl_writer_write(pool, s, fl, line, strlen(line), w->fsync != WL_FSYNC_OFF);
+      return;
     }
+
+    pending = &w->queue[(w->head + w->count) % w->size];
+    pending->path = fl;
+    apr_snprintf(pending->line, sizeof(pending->line), "%s\n", addr);
+    if (++w->count >= w->batch)
+      apr_thread_cond_signal(w->wake);
+    apr_thread_mutex_unlock(w->lock);
+
 #if WL_MODULE_DEBUG_MODE
-    AP_LOG_INFO(rec, "Whitelist disabled not adding: %s to storage list", addr);
+    AP_SLOG_DEBUG(s, "Queued %s for %s", addr, fl);
 #endif
 }
 
@@ -1105,11 +5334,27 @@ static const command_rec wl_directives[] =
     AP_INIT_TAKE1("wlListAppend", wl_set_list_append, NULL, RSRC_CONF, "SET WL's WHITELIST TO APPEND NEW ENTRIES"),
     AP_INIT_TAKE1("wlBlackList", wl_set_blist, NULL, RSRC_CONF, "SET WL'S BLACKLIST"),
     AP_INIT_TAKE1("wlBlacklistAppend", wl_set_blist_append, NULL, RSRC_CONF, "SET WL's BLACKLIST TO APPEND NEW ENTRIES"),
+    AP_INIT_TAKE1("wlAppendFlushInterval", wl_set_flush_interval, NULL, RSRC_CONF, "SET THE MILLISECONDS BETWEEN LIST APPEND FLUSHES"),
+    AP_INIT_TAKE1("wlAppendBatchSize", wl_set_flush_batch, NULL, RSRC_CONF, "SET THE NUMBER OF LIST APPENDS WRITTEN AT ONCE"),
+    AP_INIT_TAKE1("wlAppendFsync", wl_set_flush_sync, NULL, RSRC_CONF, "SET WHEN LIST APPENDS ARE FSYNCED: OFF, BATCH OR ALWAYS"),
     AP_INIT_TAKE1("wlBotList", wl_set_bot_list, NULL, RSRC_CONF, "DEBUG MODE"),
     AP_INIT_TAKE1("wlBotAutoAdd", wl_set_bot_auto_add, NULL, RSRC_CONF, "DEBUG MODE"),
-    AP_INIT_TAKE1("wlDnsTimeout", wl_set_dns_timeout, NULL, ACCESS_CONF, "DEBUG MODE"),
+    AP_INIT_TAKE1("wlDnsTimeout", wl_set_dns_timeout, NULL, RSRC_CONF, "SET THE PER LOOKUP DNS TIMEOUT IN MILLISECONDS"),
+    AP_INIT_TAKE23("wlCacheTTL", wl_set_cache_ttl, NULL, RSRC_CONF, "SET THE SECONDS VERIFIED, FAILED AND DNS ERROR VERDICTS ARE CACHED"),
+    AP_INIT_TAKE12("wlDnsMaxInFlight", wl_set_dns_max, NULL, RSRC_CONF, "SET THE VERIFICATIONS IN DNS AT ONCE PER CHILD AND SERVER WIDE"),
+    AP_INIT_TAKE1("wlDnsOverload", wl_set_dns_overload, NULL, RSRC_CONF, "SET WHETHER UNVERIFIABLE BOTS PASS WHEN DNS IS OVERLOADED: OPEN OR CLOSED"),
+    AP_INIT_TAKE12("wlVerifyMode", wl_set_verify_mode, NULL, RSRC_CONF, "SET WHETHER NEW ADDRESSES ARE VERIFIED INLINE OR IN THE BACKGROUND, WITH A REQUEST BUDGET"),
+    AP_INIT_TAKE123("wlDnsBreaker", wl_set_dns_breaker, NULL, RSRC_CONF, "SET THE PERCENT OF BAD LOOKUPS, SECONDS AND SLOW MILLISECONDS OF THE DNS BREAKER"),
+    AP_INIT_TAKE12("wlCacheSnapshot", wl_set_cache_snapshot, NULL, RSRC_CONF, "SAVE THE SHARED VERDICTS TO A FILE ON RESTART AND EVERY SO MANY SECONDS"),
+    AP_INIT_TAKE1("wlSharedSlots", wl_set_shared_slots, NULL, RSRC_CONF, "SET THE NUMBER OF VERDICTS SHARED BETWEEN CHILDREN"),
+    AP_INIT_TAKE1("wlReportLists", wl_set_report, NULL, RSRC_CONF, "LOG ENTRY COUNTS AND MEMORY OF LOADED LISTS AT STARTUP"),
+    AP_INIT_TAKE12("wlListFilter", wl_set_list_filter, NULL, RSRC_CONF, "SET THE FALSE POSITIVE RATE OF LARGE LIST FILTERS AND THE ENTRIES A LIST NEEDS, OR OFF"),
+    AP_INIT_ITERATE("wlDnsServer", wl_set_dns_server, NULL, RSRC_CONF, "SET THE NAMESERVERS USED FOR VERIFICATION"),
     AP_INIT_TAKE1("wlSubprocessEnv", wl_set_subprocess_env, NULL, RSRC_CONF|OR_ALL|ACCESS_CONF, "DEBUG MODE"),
     AP_INIT_RAW_ARGS("wlBot", wl_set_bot, NULL, RSRC_CONF, "DEBUG MODE"),
+    AP_INIT_TAKE2("wlBotRanges", wl_set_bot_ranges, NULL, RSRC_CONF, "LOAD THE PUBLISHED IP RANGES OF A BOT, VERIFIED WITHOUT DNS"),
+    AP_INIT_TAKE1("wlBotRangesRefresh", wl_set_ranges_refresh, NULL, RSRC_CONF, "SET THE SECONDS BETWEEN CHECKS OF WLBOTRANGES FILES"),
+    AP_INIT_ITERATE2("wlBotDomains", wl_set_bot_domains, NULL, RSRC_CONF, "SET THE HOST NAME SUFFIXES A BOT'S PTR RECORDS MUST END IN"),
     { NULL }
 };
 
@@ -1119,9 +5364,9 @@ module AP_MODULE_DECLARE_DATA   wl_module =
 { 
     STANDARD20_MODULE_STUFF,
     wl_dir_config,          /* Per-directory configuration handler */
-    NULL,                   /* Merge handler for per-directory configurations */
+    wl_merge_config,        /* Merge handler for per-directory configurations */
     wl_server_config,                   /* Per-server configuration handler */
-    NULL,                   /* Merge handler for per-server configurations */
+    wl_merge_config,        /* Merge handler for per-server configurations */
     wl_directives,          /* Any directives we may have for httpd */
     wl_hooks                /* Our hook registering function */
 };
@@ -0,0 +1,74 @@
+/* 
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ *
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ /*
+ * wl_compile.c
+ *
+ * Compiles a WLList / WLBlacklist text list into the
+ * binary index mod_wl maps at startup.
+ *
+ * usage: wl_compile list.wl list.wlb
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "wl_match.h"
+
+/**
+ * report a list line that is not an address
+ */
+static void wl_badline(void* baton, const char* path, unsigned long lineno, const char* line)
+{
+    (void) baton;
+    fprintf(stderr, "%s:%lu: invalid address %s\n", path, lineno, line);
+}
+
+int main(int argc, char** argv)
+{
+    struct wl_trie t = WL_TRIE_INIT;
+    unsigned long bad = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <list> <index>\n", argv[0]);
+        return 2;
+    }
+
+    switch (wl_trie_read(&t, argv[1], wl_badline, NULL, &bad)) {
+    case WL_INDEX_OK:
+        break;
+    case WL_INDEX_NOMEM:
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    default:
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (wl_trie_write(&t, argv[2]) != WL_INDEX_OK) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    printf("%s: %u entries, %u nodes, %lu bytes, %lu invalid lines skipped\n",
+           argv[2], t.entries, t.count,
+           (unsigned long) (sizeof(struct wl_index_header) + t.count * sizeof(struct wl_trie_node)), bad);
+
+    wl_trie_free(&t);
+    return 0;
+}
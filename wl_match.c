@@ -0,0 +1,1241 @@
+/* 
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ *
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ /*
+ * wl_match.c
+ *
+ * Prefix trie used for WLList / WLBlacklist, its
+ * memory-mapped binary index format, the text list
+ * reader and the WLBot user agent matcher.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "wl_match.h"
+
+/**
+ * parse an IPv4 or IPv6 address, optionally
+ * with a /bits prefix, into its binary network
+ * and prefix length. IPv4 is normalized to its
+ * IPv4-mapped form. does not allocate or touch
+ * the input
+ *
+ * @param net -> address or CIDR
+ * @param c_addr -> parsed address
+ */
+int wl_create_addr(const char* net, struct wl_addr* c_addr)
+{
+    char buf[INET6_ADDRSTRLEN];
+    unsigned char raw[16];
+    const char* slash;
+    size_t len;
+    char* end;
+    long bits, max;
+    int i, v6;
+
+    slash = strchr(net, '/');
+    len = slash ? (size_t) (slash - net) : strlen(net);
+    if (len == 0 || len >= sizeof(buf))
+        return -1;
+
+    memcpy(buf, net, len);
+    buf[len] = '\0';
+
+    v6 = memchr(buf, ':', len) != NULL;
+    if (inet_pton(v6 ? AF_INET6 : AF_INET, buf, raw) != 1)
+        return -1;
+
+    max = v6 ? WL_ADDR_BITS : 32;
+    bits = max;
+    if (slash) {
+        bits = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || bits < 0 || bits > max)
+            return -1;
+    }
+
+    if (v6) {
+        for (i = 0; i < 4; i++)
+            c_addr->net[i] = (uint32_t) raw[4 * i] << 24 | (uint32_t) raw[4 * i + 1] << 16
+                           | (uint32_t) raw[4 * i + 2] << 8 | raw[4 * i + 3];
+        c_addr->bits = (int) bits;
+    } else {
+        c_addr->net[0] = c_addr->net[1] = 0;
+        c_addr->net[2] = 0xFFFF;
+        c_addr->net[3] = (uint32_t) raw[0] << 24 | (uint32_t) raw[1] << 16
+                       | (uint32_t) raw[2] << 8 | raw[3];
+        c_addr->bits = WL_ADDR_V4 + (int) bits;
+    }
+
+    return 0;
+}
+
+/**
+ * do two parsed addresses name the same host,
+ * whatever family they were written in
+ *
+ * @param a -> address
+ * @param b -> address
+ */
+int wl_addr_same(const struct wl_addr* a, const struct wl_addr* b)
+{
+    return memcmp(a->net, b->net, sizeof(a->net)) == 0;
+}
+
+/**
+ * is this an IPv4 (mapped) address
+ *
+ * @param a -> address
+ */
+int wl_addr_is_v4(const struct wl_addr* a)
+{
+    return a->net[0] == 0 && a->net[1] == 0 && a->net[2] == 0xFFFF;
+}
+
+/**
+ * netmask for a prefix length
+ *
+ * @param bits -> prefix length 0..32
+ */
+static inline uint32_t wl_mask(int bits)
+{
+    // C99 6.5.7 (3): u32 << 32 is undefined behaviour
+    return bits <= 0 ? 0 : bits >= 32 ? 0xFFFFFFFFu : 0xFFFFFFFFu << (32 - bits);
+}
+
+/**
+ * bit of an address at a given depth
+ * (0 is the most significant bit)
+ */
+static inline int wl_bit(const uint32_t* net, int pos)
+{
+    return (net[pos >> 5] >> (31 - (pos & 31))) & 1;
+}
+
+/**
+ * number of leading bits two addresses share
+ */
+static inline int wl_common(const uint32_t* a, const uint32_t* b)
+{
+    uint32_t diff;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        diff = a[i] ^ b[i];
+        if (diff)
+            return i * 32 + __builtin_clz(diff);
+    }
+
+    return WL_ADDR_BITS;
+}
+
+/**
+ * copy an address keeping its first bits
+ */
+static inline void wl_masked(uint32_t* out, const uint32_t* net, int bits)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        out[i] = net[i] & wl_mask(bits - 32 * i);
+}
+
+/**
+ * make room for n more trie nodes so pointers
+ * into the node array stay valid while inserting
+ *
+ * @param t -> trie
+ * @param n -> nodes needed
+ */
+static int wl_trie_reserve(struct wl_trie* t, uint32_t n)
+{
+    struct wl_trie_node* nodes;
+    uint32_t cap;
+
+    if (t->count + n <= t->cap)
+        return 0;
+
+    cap = t->cap ? t->cap * 2 : 64;
+    while (cap < t->count + n)
+        cap *= 2;
+
+    nodes = realloc(t->nodes, cap * sizeof(struct wl_trie_node));
+    if (nodes == NULL)
+        return -1;
+
+    t->nodes = nodes;
+    t->cap = cap;
+    return 0;
+}
+
+static uint32_t wl_trie_node_new(struct wl_trie* t, const uint32_t* net, int bits, int term)
+{
+    struct wl_trie_node* n = &t->nodes[t->count];
+
+    memcpy(n->net, net, sizeof(n->net));
+    n->bits = (uint8_t) bits;
+    n->term = (uint8_t) term;
+    memset(n->pad, 0, sizeof(n->pad));
+    n->child[0] = n->child[1] = WL_TRIE_NIL;
+
+    return t->count++;
+}
+
+/**
+ * insert a network into the trie. nodes
+ * only exist where two prefixes branch, so
+ * the trie holds at most 2n nodes for n entries
+ *
+ * @param t -> trie
+ * @param a -> network / prefix
+ */
+int wl_trie_insert(struct wl_trie* t, const struct wl_addr* a)
+{
+    struct wl_trie_node* n;
+    uint32_t* link;
+    uint32_t net[4], pre[4], idx, glue;
+    int common;
+
+    /* a mapped index is read-only */
+    if (t->map != NULL || wl_trie_reserve(t, 2) != 0)
+        return -1;
+
+    wl_masked(net, a->net, a->bits);
+    link = &t->root;
+
+    while (*link != WL_TRIE_NIL) {
+        n = &t->nodes[*link];
+        common = wl_common(n->net, net);
+        if (common > n->bits)
+            common = n->bits;
+        if (common > a->bits)
+            common = a->bits;
+
+        if (common == n->bits) {
+            if (a->bits == n->bits) {
+                if (!n->term) {
+                    n->term = 1;
+                    t->entries++;
+                }
+                return 0;
+            }
+            link = &n->child[wl_bit(net, n->bits)];
+            continue;
+        }
+
+        if (common == a->bits) {
+            /* new network covers this node */
+            idx = wl_trie_node_new(t, net, a->bits, 1);
+            t->nodes[idx].child[wl_bit(n->net, a->bits)] = *link;
+            *link = idx;
+            t->entries++;
+            return 0;
+        }
+
+        /* branch where the two prefixes diverge */
+        wl_masked(pre, net, common);
+        glue = wl_trie_node_new(t, pre, common, 0);
+        idx = wl_trie_node_new(t, net, a->bits, 1);
+        t->nodes[glue].child[wl_bit(net, common)] = idx;
+        t->nodes[glue].child[wl_bit(n->net, common)] = *link;
+        *link = glue;
+        t->entries++;
+        return 0;
+    }
+
+    *link = wl_trie_node_new(t, net, a->bits, 1);
+    t->entries++;
+    return 0;
+}
+
+/**
+ * longest prefix match
+ * returns the prefix length of the most specific
+ * network holding ip or -1 when none does
+ *
+ * @param t -> trie
+ * @param ip -> address words as in struct wl_addr
+ */
+int wl_trie_lookup(const struct wl_trie* t, const uint32_t ip[4])
+{
+    const struct wl_trie_node* n;
+    uint32_t idx = t->root;
+    int found = -1;
+
+    /* NIL is never below count, so this also keeps
+     * a damaged index from leading outside the array */
+    while (idx < t->count) {
+        n = &t->nodes[idx];
+        if (wl_common(ip, n->net) < n->bits)
+            break;
+        if (n->term)
+            found = n->bits;
+        if (n->bits >= WL_ADDR_BITS)
+            break;
+        idx = n->child[wl_bit(ip, n->bits)];
+    }
+
+    return found;
+}
+
+/**
+ * shrink an owned node array to what is used
+ * once a list is fully loaded
+ *
+ * @param t -> trie
+ */
+void wl_trie_compact(struct wl_trie* t)
+{
+    struct wl_trie_node* nodes;
+
+    if (t->map != NULL || t->count == t->cap || t->count == 0)
+        return;
+
+    nodes = realloc(t->nodes, t->count * sizeof(struct wl_trie_node));
+    if (nodes == NULL)
+        return;
+
+    t->nodes = nodes;
+    t->cap = t->count;
+}
+
+/**
+ * bytes a trie holds, the mapping
+ * or the allocated node array
+ *
+ * @param t -> trie
+ */
+size_t wl_trie_bytes(const struct wl_trie* t)
+{
+    if (t->map != NULL)
+        return t->maplen;
+
+    return (size_t) t->cap * sizeof(struct wl_trie_node);
+}
+
+/**
+ * release a trie, owned or mapped
+ *
+ * @param t -> trie
+ */
+void wl_trie_free(struct wl_trie* t)
+{
+    if (t->map != NULL)
+        munmap(t->map, t->maplen);
+    else
+        free(t->nodes);
+
+    t->nodes = NULL;
+    t->map = NULL;
+    t->maplen = 0;
+    t->count = t->cap = t->entries = 0;
+    t->root = WL_TRIE_NIL;
+}
+
+/**
+ * FNV-1a over len bytes, carrying on from h
+ */
+static uint32_t wl_index_fnv(uint32_t h, const void* data, size_t len)
+{
+    const unsigned char* p = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/**
+ * FNV-1a over the header and the first and last
+ * WL_INDEX_SAMPLE bytes of the node array, so a map
+ * costs the same for any size. the file is renamed
+ * into place whole and its size is checked, this
+ * catches a header or nodes from another build
+ */
+static uint32_t wl_index_checksum(const struct wl_index_header* hdr, const struct wl_trie_node* nodes)
+{
+    const unsigned char* p = (const unsigned char*) nodes;
+    size_t len = (size_t) hdr->count * sizeof(struct wl_trie_node);
+    uint32_t h = 2166136261u;
+
+    h = wl_index_fnv(h, hdr, offsetof(struct wl_index_header, checksum));
+    if (len <= 2 * WL_INDEX_SAMPLE)
+        return wl_index_fnv(h, p, len);
+
+    h = wl_index_fnv(h, p, WL_INDEX_SAMPLE);
+    return wl_index_fnv(h, p + len - WL_INDEX_SAMPLE, WL_INDEX_SAMPLE);
+}
+
+/**
+ * write a trie as a binary index. the file is
+ * written next to path and renamed over it so
+ * processes mapping the old index keep a valid copy
+ *
+ * @param t -> trie
+ * @param path -> index file
+ */
+int wl_trie_write(const struct wl_trie* t, const char* path)
+{
+    struct wl_index_header h;
+    char tmp[4096];
+    FILE* fp;
+    int ok;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))
+        return WL_INDEX_IOERR;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = WL_INDEX_MAGIC;
+    h.version = WL_INDEX_VERSION;
+    h.count = t->count;
+    h.root = t->root;
+    h.entries = t->entries;
+    h.checksum = wl_index_checksum(&h, t->nodes);
+
+    fp = fopen(tmp, "wb");
+    if (fp == NULL)
+        return WL_INDEX_IOERR;
+
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1
+        && (t->count == 0 || fwrite(t->nodes, sizeof(struct wl_trie_node), t->count, fp) == t->count);
+    ok = (fflush(fp) == 0 && fsync(fileno(fp)) == 0) && ok;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return WL_INDEX_IOERR;
+    }
+
+    return WL_INDEX_OK;
+}
+
+/**
+ * map a binary index read-only. the pages come
+ * from the page cache, so every process mapping
+ * the same file shares one physical copy. returns
+ * WL_INDEX_NOT when the file is a text list
+ *
+ * @param t -> trie receiving the index
+ * @param path -> index file
+ */
+int wl_trie_map(struct wl_trie* t, const char* path)
+{
+    const struct wl_index_header* h;
+    struct stat st;
+    uint32_t magic = 0;
+    void* map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return WL_INDEX_IOERR;
+
+    if (fstat(fd, &st) != 0 || read(fd, &magic, sizeof(magic)) != sizeof(magic)
+        || magic != WL_INDEX_MAGIC) {
+        close(fd);
+        return WL_INDEX_NOT;
+    }
+
+    if ((size_t) st.st_size < sizeof(struct wl_index_header)) {
+        close(fd);
+        return WL_INDEX_BAD;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return WL_INDEX_IOERR;
+
+    h = map;
+    if (h->version != WL_INDEX_VERSION
+        || (size_t) st.st_size != sizeof(*h) + (size_t) h->count * sizeof(struct wl_trie_node)
+        || (h->root != WL_TRIE_NIL && h->root >= h->count)
+        || wl_index_checksum(h, (const struct wl_trie_node*) (h + 1)) != h->checksum) {
+        munmap(map, st.st_size);
+        return WL_INDEX_BAD;
+    }
+
+    wl_trie_free(t);
+    t->map = map;
+    t->maplen = st.st_size;
+    t->nodes = (struct wl_trie_node*) (h + 1);
+    t->count = h->count;
+    t->root = h->root;
+    t->entries = h->entries;
+
+    return WL_INDEX_OK;
+}
+
+/**
+ * trim whitespace around a list line
+ *
+ * @param line -> line read from the list
+ */
+static char* wl_trim(char* line)
+{
+    char* end;
+
+    while (isspace((unsigned char) *line))
+        line++;
+
+    end = line + strlen(line);
+    while (end > line && isspace((unsigned char) end[-1]))
+        *--end = '\0';
+
+    return line;
+}
+
+/**
+ * read a text list, one address or CIDR per
+ * line. blank lines and # comments are skipped,
+ * anything else that does not parse is counted
+ * and passed to badline
+ *
+ * @param t -> trie receiving the entries
+ * @param path -> list file
+ * @param badline -> called per invalid line, may be NULL
+ * @param baton -> passed to badline
+ * @param bad -> number of invalid lines
+ */
+int wl_trie_read(struct wl_trie* t, const char* path, wl_badline_fn badline, void* baton, unsigned long* bad)
+{
+    struct wl_addr a;
+    char data[256];
+    char* line;
+    unsigned long lineno = 0;
+    size_t len;
+    int c, st = WL_INDEX_OK;
+    FILE* fp;
+
+    *bad = 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return WL_INDEX_IOERR;
+
+    while (fgets(data, sizeof(data), fp) != NULL) {
+        lineno++;
+
+        /* longer than any address: drop the rest of the line */
+        len = strlen(data);
+        if (len == sizeof(data) - 1 && data[len - 1] != '\n') {
+            while ((c = getc(fp)) != EOF && c != '\n')
+                ;
+            (*bad)++;
+            if (badline != NULL)
+                badline(baton, path, lineno, "(line too long)");
+            continue;
+        }
+
+        line = wl_trim(data);
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        if (wl_create_addr(line, &a) != 0) {
+            (*bad)++;
+            if (badline != NULL)
+                badline(baton, path, lineno, line);
+            continue;
+        }
+        if (wl_trie_insert(t, &a) != 0) {
+            st = WL_INDEX_NOMEM;
+            break;
+        }
+    }
+
+    if (ferror(fp) && st == WL_INDEX_OK)
+        st = WL_INDEX_IOERR;
+    fclose(fp);
+
+    return st;
+}
+
+/**
+ * the value of a JSON string starting at p, unescaped
+ * in place. returns the character after the closing
+ * quote, or NULL if the string does not end
+ *
+ * @param p -> first character inside the quotes
+ * @param lineno -> incremented for escaped newlines
+ */
+static char* wl_json_string(char* p, unsigned long* lineno)
+{
+    char* out = p;
+
+    for (; *p != '"'; p++) {
+        if (*p == '\0')
+            return NULL;
+        if (*p == '\n')
+            (*lineno)++;
+        if (*p == '\\' && *++p == '\0')
+            return NULL;
+        *out++ = *p;
+    }
+    *out = '\0';
+
+    return p + 1;
+}
+
+/**
+ * read a published range file: the JSON crawler
+ * lists search engines publish, where every string
+ * under a key ending in "prefix" (ipv4Prefix,
+ * ipv6Prefix, ip_prefix) is a network, or anything
+ * else as a text list like wl_trie_read/5
+ *
+ * @param t -> trie to add to
+ * @param path -> range file
+ * @param badline -> called for each value that is not a network, may be NULL
+ * @param baton -> passed to badline
+ * @param bad -> number of values skipped
+ */
+int wl_trie_read_ranges(struct wl_trie* t, const char* path, wl_badline_fn badline, void* baton, unsigned long* bad)
+{
+    struct wl_addr a;
+    struct stat sb;
+    char* buf;
+    char* p;
+    char* key = NULL;
+    char* value;
+    unsigned long lineno = 1;
+    size_t klen;
+    int fd, st = WL_INDEX_OK;
+    ssize_t n;
+
+    *bad = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return WL_INDEX_IOERR;
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return WL_INDEX_IOERR;
+    }
+
+    buf = malloc(sb.st_size + 1);
+    if (buf == NULL) {
+        close(fd);
+        return WL_INDEX_NOMEM;
+    }
+    for (p = buf; p < buf + sb.st_size; p += n) {
+        n = read(fd, p, buf + sb.st_size - p);
+        if (n <= 0)
+            break;
+    }
+    close(fd);
+    *p = '\0';
+
+    for (p = buf; isspace((unsigned char) *p); p++)
+        ;
+    if (*p != '{' && *p != '[') {
+        free(buf);
+        return wl_trie_read(t, path, badline, baton, bad);
+    }
+
+    /* a string followed by ':' is a key, the next
+     * string is its value */
+    while (*p != '\0') {
+        if (*p == '\n')
+            lineno++;
+        if (*p != '"') {
+            p++;
+            continue;
+        }
+
+        value = p + 1;
+        p = wl_json_string(value, &lineno);
+        if (p == NULL)
+            break;
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p == ':') {
+            key = value;
+            continue;
+        }
+
+        klen = key != NULL ? strlen(key) : 0;
+        if (klen < 6 || strcasecmp(key + klen - 6, "prefix") != 0)
+            continue;
+        key = NULL;
+
+        if (wl_create_addr(wl_trim(value), &a) != 0) {
+            (*bad)++;
+            if (badline != NULL)
+                badline(baton, path, lineno, value);
+            continue;
+        }
+        if (wl_trie_insert(t, &a) != 0) {
+            st = WL_INDEX_NOMEM;
+            break;
+        }
+    }
+
+    free(buf);
+    return st;
+}
+
+/**
+ * murmur3 finalizer, spreads every input
+ * bit over the whole word
+ */
+static inline uint64_t wl_mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/**
+ * hash of a network, the length taking part
+ * so 10.0.0.0/8 and 10.0.0.0/16 differ
+ */
+static inline uint64_t wl_bloom_hash(const uint32_t* net, int bits)
+{
+    uint64_t hi = (uint64_t) net[0] << 32 | net[1];
+    uint64_t lo = (uint64_t) net[2] << 32 | net[3];
+
+    return wl_mix64(hi ^ wl_mix64(lo + (uint64_t) (bits + 1) * 0x9e3779b97f4a7c15ull));
+}
+
+/**
+ * the block of a hash and the k bits of it the
+ * key sets. set adds them, otherwise returns
+ * whether all are set
+ */
+static inline int wl_bloom_probe(const struct wl_bloom* b, uint64_t h, int set)
+{
+    uint64_t* block = b->blocks + (size_t) (((h >> 32) * b->nblocks) >> 32) * (WL_BLOOM_BLOCK / 64);
+    uint64_t x = wl_mix64(h);
+    uint32_t pos;
+    int i;
+
+    /* 9 independent bits per position, 7 to a word.
+     * a stride (g + i * d) lines up the bits of keys
+     * sharing d and costs ten times the rate */
+    for (i = 0; i < b->k; i++, x >>= 9) {
+        if (i > 0 && i % 7 == 0)
+            x = wl_mix64(h + (uint64_t) i * 0x9e3779b97f4a7c15ull);
+        pos = (uint32_t) x % WL_BLOOM_BLOCK;
+        if (set)
+            block[pos >> 6] |= 1ull << (pos & 63);
+        else if (!(block[pos >> 6] & (1ull << (pos & 63))))
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * base 2 logarithm of 1 / rate, close enough to
+ * size a filter without pulling in libm
+ */
+static double wl_bloom_log2inv(double rate)
+{
+    double l = 0;
+
+    while (rate < 0.5) {
+        rate *= 2;
+        l++;
+    }
+
+    /* rate is in [0.5, 1): -log2 is about 2 (1 - rate) */
+    return l + 2 * (1 - rate);
+}
+
+/**
+ * build a filter holding every network of a trie.
+ * a lookup of an address outside all of them is
+ * rejected with the given false positive rate.
+ * a list with more than WL_BLOOM_MAX_LENS prefix
+ * lengths is not worth filtering: returns
+ * WL_BLOOM_TOO_MANY and leaves b empty
+ *
+ * @param b -> filter, freed first
+ * @param t -> trie, owned or mapped
+ * @param rate -> false positive rate, 0 < rate < 1
+ */
+int wl_bloom_build(struct wl_bloom* b, const struct wl_trie* t, double rate)
+{
+    uint8_t seen[WL_ADDR_BITS + 1];
+    double l2, bpk;
+    uint32_t i;
+    size_t bytes;
+    void* map;
+
+    wl_bloom_free(b);
+    if (t->entries == 0 || rate <= 0 || rate >= 1)
+        return WL_INDEX_OK;
+
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; i < t->count; i++) {
+        if (t->nodes[i].term && !seen[t->nodes[i].bits]) {
+            if (b->nlens == WL_BLOOM_MAX_LENS) {
+                b->nlens = 0;
+                return WL_BLOOM_TOO_MANY;
+            }
+            seen[t->nodes[i].bits] = 1;
+            b->lens[b->nlens++] = t->nodes[i].bits;
+        }
+    }
+
+    /* a miss is probed once per length, so each probe
+     * gets its share of the rate. a blocked filter needs
+     * more room than a plain one for the same, more so
+     * the lower the rate as blocks fill unevenly */
+    l2 = wl_bloom_log2inv(rate / b->nlens);
+    bpk = 1.44 * l2 + 0.5 + (l2 > 7 ? 0.55 * (l2 - 7) : 0);
+    b->k = (int) (bpk * 0.693 + 0.5);
+    if (b->k < 1)
+        b->k = 1;
+    if (b->k > WL_BLOOM_MAX_K)
+        b->k = WL_BLOOM_MAX_K;
+
+    b->nblocks = (uint32_t) ((double) t->entries * bpk / WL_BLOOM_BLOCK) + 1;
+    bytes = (size_t) b->nblocks * (WL_BLOOM_BLOCK / 8);
+
+    map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        b->nblocks = 0;
+        b->nlens = 0;
+        return WL_INDEX_NOMEM;
+    }
+    b->blocks = map;
+    b->bytes = bytes;
+
+    for (i = 0; i < t->count; i++) {
+        if (t->nodes[i].term)
+            wl_bloom_probe(b, wl_bloom_hash(t->nodes[i].net, t->nodes[i].bits), 1);
+    }
+
+    return WL_INDEX_OK;
+}
+
+/**
+ * can ip be inside a network of the filter.
+ * 0 means surely not, 1 asks the trie. an
+ * empty filter always says 1
+ *
+ * @param b -> filter
+ * @param ip -> address words as in struct wl_addr
+ */
+int wl_bloom_maybe(const struct wl_bloom* b, const uint32_t ip[4])
+{
+    uint32_t net[4];
+    int i;
+
+    if (b->blocks == NULL)
+        return 1;
+
+    for (i = 0; i < b->nlens; i++) {
+        wl_masked(net, ip, b->lens[i]);
+        if (wl_bloom_probe(b, wl_bloom_hash(net, b->lens[i]), 0))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * release a filter
+ *
+ * @param b -> filter
+ */
+void wl_bloom_free(struct wl_bloom* b)
+{
+    if (b->blocks != NULL)
+        munmap(b->blocks, b->bytes);
+
+    b->blocks = NULL;
+    b->nblocks = 0;
+    b->bytes = 0;
+    b->nlens = 0;
+    b->k = 0;
+}
+
+/**
+ * a bot without ERE metacharacters is
+ * matched as a plain substring. a lone '.' is
+ * taken literally so version tokens like
+ * Googlebot/2.1 stay on the fast path
+ *
+ * @param bot -> WLBot pattern
+ */
+int wl_bot_is_literal(const char* bot)
+{
+    return strpbrk(bot, "[]()*+?{}|^$\\") == NULL;
+}
+
+/**
+ * release a compiled matcher
+ *
+ * @param m -> matcher
+ */
+void wl_matcher_free(struct wl_matcher* m)
+{
+    int i;
+
+    if (m == NULL)
+        return;
+
+    for (i = 0; i < m->nrgx; i++)
+        regfree(&m->rgx[i]);
+
+    free(m->rgx);
+    free(m->rgxid);
+    free(m->delta);
+    free(m->out);
+    free(m->bots);
+    free(m);
+}
+
+/**
+ * compile a list of bots into one matcher.
+ * called whenever the bot list changes, never per
+ * request. on WL_MATCHER_BADRE badre names the
+ * pattern that failed
+ *
+ * @param bots -> bots to compile
+ * @param out -> new matcher
+ * @param badre -> pattern that did not compile
+ */
+int wl_matcher_build(const struct wl_bot_list* bots, struct wl_matcher** out, const char** badre)
+{
+    struct wl_matcher* m;
+    const struct wl_bot_list* bot;
+    const unsigned char* p;
+    int32_t* fail;
+    int32_t* queue;
+    int32_t s, t, f;
+    int maxstates = 1, nlit = 0, nrgx = 0, nbots = 0, id = 0;
+    int head = 0, tail = 0, c;
+
+    for (bot = bots; bot != NULL; bot = bot->next) {
+        nbots++;
+        if (bot->name[0] == '\0')
+            continue;
+        if (bot->literal) {
+            maxstates += strlen(bot->name);
+            nlit++;
+        } else {
+            nrgx++;
+        }
+    }
+
+    m = calloc(1, sizeof(struct wl_matcher));
+    if (m == NULL)
+        return WL_MATCHER_NOMEM;
+
+    /* every byte used by a literal gets its own class,
+     * all other bytes share class 0 which leads to the root */
+    m->nclasses = 1;
+    for (bot = bots; bot != NULL; bot = bot->next) {
+        if (!bot->literal)
+            continue;
+        for (p = (const unsigned char*) bot->name; *p; p++) {
+            if (m->cls[*p] == 0)
+                m->cls[*p] = m->nclasses++;
+        }
+    }
+
+    m->delta = malloc(sizeof(int32_t) * maxstates * m->nclasses);
+    m->out = malloc(sizeof(int32_t) * maxstates);
+    m->rgx = calloc(nrgx ? nrgx : 1, sizeof(regex_t));
+    m->rgxid = malloc(sizeof(int32_t) * (nrgx ? nrgx : 1));
+    m->bots = malloc(sizeof(struct wl_bot_list*) * (nbots ? nbots : 1));
+    fail = malloc(sizeof(int32_t) * maxstates);
+    queue = malloc(sizeof(int32_t) * maxstates);
+
+    if (!m->delta || !m->out || !m->rgx || !m->rgxid || !m->bots || !fail || !queue) {
+        free(fail);
+        free(queue);
+        wl_matcher_free(m);
+        return WL_MATCHER_NOMEM;
+    }
+
+    memset(m->delta, 0xff, sizeof(int32_t) * maxstates * m->nclasses);
+    m->out[0] = -1;
+    m->nstates = 1;
+
+    for (bot = bots; bot != NULL; bot = bot->next, id++) {
+        m->bots[id] = bot;
+        if (bot->name[0] == '\0')
+            continue;
+
+        if (!bot->literal) {
+            if (regcomp(&m->rgx[m->nrgx], bot->name, REG_EXTENDED | REG_NOSUB) != 0) {
+                free(fail);
+                free(queue);
+                wl_matcher_free(m);
+                if (badre != NULL)
+                    *badre = bot->name;
+                return WL_MATCHER_BADRE;
+            }
+            m->rgxid[m->nrgx++] = id;
+            continue;
+        }
+
+        if (strchr(m->start, bot->name[0]) == NULL)
+            m->start[m->nstart++] = bot->name[0];
+
+        s = 0;
+        for (p = (const unsigned char*) bot->name; *p; p++) {
+            t = m->delta[s * m->nclasses + m->cls[*p]];
+            if (t < 0) {
+                t = m->nstates++;
+                m->out[t] = -1;
+                m->delta[s * m->nclasses + m->cls[*p]] = t;
+            }
+            s = t;
+        }
+        if (m->out[s] < 0)
+            m->out[s] = id;
+    }
+
+    /* breadth first over the keyword tree turning it
+     * into a DFA: missing edges follow the failure links */
+    fail[0] = 0;
+    for (c = 0; c < m->nclasses; c++) {
+        t = m->delta[c];
+        if (t < 0) {
+            m->delta[c] = 0;
+        } else {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+        f = fail[s];
+        if (m->out[s] < 0)
+            m->out[s] = m->out[f];
+
+        for (c = 0; c < m->nclasses; c++) {
+            t = m->delta[s * m->nclasses + c];
+            if (t < 0) {
+                m->delta[s * m->nclasses + c] = m->delta[f * m->nclasses + c];
+            } else {
+                fail[t] = m->delta[f * m->nclasses + c];
+                queue[tail++] = t;
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+
+    /* the state count was an upper bound, the
+     * matcher is kept for the life of the server */
+    if (m->nstates < maxstates) {
+        int32_t* d = realloc(m->delta, sizeof(int32_t) * m->nstates * m->nclasses);
+        int32_t* o = realloc(m->out, sizeof(int32_t) * m->nstates);
+        if (d != NULL)
+            m->delta = d;
+        if (o != NULL)
+            m->out = o;
+    }
+
+    *out = m;
+
+    return WL_MATCHER_OK;
+}
+
+/**
+ * the first literal bot that occurs in the agent,
+ * or NULL. one pass, spaces are skipped the same
+ * way they are stripped from WLBot values
+ *
+ * @param m -> matcher
+ * @param agent -> User-Agent, not modified
+ */
+const struct wl_bot_list* wl_matcher_scan(const struct wl_matcher* m, const char* agent)
+{
+    const unsigned char* p;
+    int32_t state = 0;
+
+    if (m->nstates <= 1)
+        return NULL;
+
+    for (p = (const unsigned char*) agent; *p; p++) {
+        if (state == 0) {
+            /* nothing partially matched: jump to the next
+             * byte that starts a bot, strcspn is vectorized */
+            p += strcspn((const char*) p, m->start);
+            if (*p == '\0')
+                break;
+        }
+        if (*p == ' ')
+            continue;
+        state = m->delta[state * m->nclasses + m->cls[*p]];
+        if (m->out[state] >= 0)
+            return m->bots[m->out[state]];
+    }
+
+    return NULL;
+}
+
+/**
+ * the first expression bot matching the agent, or NULL
+ *
+ * @param m -> matcher
+ * @param agent -> User-Agent with its spaces removed
+ */
+const struct wl_bot_list* wl_matcher_regex(const struct wl_matcher* m, const char* agent)
+{
+    int i;
+
+    for (i = 0; i < m->nrgx; i++) {
+        if (regexec(&m->rgx[i], agent, 0, NULL, 0) == 0)
+            return m->bots[m->rgxid[i]];
+    }
+
+    return NULL;
+}
+
+/**
+ * release compiled domain suffixes
+ *
+ * @param d -> suffixes
+ */
+void wl_domains_free(struct wl_domains* d)
+{
+    if (d == NULL)
+        return;
+
+    free(d->delta);
+    free(d->accept);
+    free(d);
+}
+
+/**
+ * compile hostname suffixes (googlebot.com, google.com)
+ * into one automaton over reversed names. case is
+ * ignored, leading and trailing dots are dropped
+ *
+ * @param suffixes -> allowed suffixes
+ * @param n -> number of suffixes
+ * @param out -> new automaton
+ */
+int wl_domains_build(const char* const* suffixes, int n, struct wl_domains** out)
+{
+    struct wl_domains* d;
+    const char* sfx;
+    size_t len;
+    int32_t s, t;
+    int i, j, c, maxstates = 1;
+
+    for (i = 0; i < n; i++)
+        maxstates += strlen(suffixes[i]);
+
+    d = calloc(1, sizeof(struct wl_domains));
+    if (d == NULL)
+        return WL_MATCHER_NOMEM;
+
+    /* upper and lower case share a class, every
+     * other byte falls into class 0 and fails */
+    d->nclasses = 1;
+    for (i = 0; i < n; i++) {
+        for (sfx = suffixes[i]; *sfx; sfx++) {
+            c = tolower((unsigned char) *sfx);
+            if (d->cls[c] == 0) {
+                d->cls[c] = d->nclasses;
+                d->cls[toupper(c)] = d->nclasses++;
+            }
+        }
+    }
+
+    d->delta = malloc(sizeof(int32_t) * maxstates * d->nclasses);
+    d->accept = calloc(maxstates, 1);
+    if (d->delta == NULL || d->accept == NULL) {
+        wl_domains_free(d);
+        return WL_MATCHER_NOMEM;
+    }
+    memset(d->delta, 0xff, sizeof(int32_t) * maxstates * d->nclasses);
+    d->nstates = 1;
+
+    for (i = 0; i < n; i++) {
+        sfx = suffixes[i];
+        while (*sfx == '.')
+            sfx++;
+        len = strlen(sfx);
+        while (len > 0 && sfx[len - 1] == '.')
+            len--;
+        if (len == 0)
+            continue;
+
+        s = 0;
+        for (j = (int) len - 1; j >= 0; j--) {
+            c = d->cls[(unsigned char) sfx[j]];
+            t = d->delta[s * d->nclasses + c];
+            if (t < 0) {
+                t = d->nstates++;
+                d->delta[s * d->nclasses + c] = t;
+            }
+            s = t;
+        }
+        d->accept[s] = 1;
+    }
+
+    *out = d;
+
+    return WL_MATCHER_OK;
+}
+
+/**
+ * does the host name end in one of the suffixes,
+ * on a label boundary. one walk from the end of
+ * the name, a trailing dot is ignored
+ *
+ * @param d -> compiled suffixes
+ * @param name -> host name, e.g. from a PTR record
+ */
+int wl_domains_match(const struct wl_domains* d, const char* name)
+{
+    size_t i = strlen(name);
+    int32_t state = 0;
+
+    if (i > 0 && name[i - 1] == '.')
+        i--;
+
+    while (i-- > 0) {
+        state = d->delta[state * d->nclasses + d->cls[(unsigned char) name[i]]];
+        if (state < 0)
+            return 0;
+        if (d->accept[state] && (i == 0 || name[i - 1] == '.'))
+            return 1;
+    }
+
+    return 0;
+}
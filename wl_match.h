@@ -0,0 +1,186 @@
+/* 
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ *
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ /*
+ * wl_match.h
+ *
+ * Address and user agent matching core shared by
+ * mod_wl, the wl_compile list compiler and the
+ * benchmark harness. Has no Apache or APR
+ * dependencies.
+ */
+
+#ifndef WL_MATCH_H
+#define WL_MATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <regex.h>
+
+#define WL_TRIE_NIL 0xFFFFFFFFu
+#define WL_TRIE_INIT { NULL, 0, 0, WL_TRIE_NIL, 0, NULL, 0 }
+
+#define WL_INDEX_MAGIC 0x58494C57u    /* "WLIX" read on this host */
+#define WL_INDEX_VERSION 3          /* 2: 128-bit keys, 3: sampled checksum */
+#define WL_INDEX_SAMPLE 4096        /* node bytes at each end the checksum covers */
+
+#define WL_INDEX_OK 0
+#define WL_INDEX_NOT 1              /* not an index, parse as text */
+#define WL_INDEX_BAD -1             /* wrong version, size or checksum */
+#define WL_INDEX_IOERR -2
+#define WL_INDEX_NOMEM -3
+
+#define WL_MATCHER_OK 0
+#define WL_MATCHER_NOMEM -1
+#define WL_MATCHER_BADRE -2          /* a pattern did not compile */
+
+#define WL_ADDR_BITS 128
+#define WL_ADDR_V4 96               /* IPv4 lives at ::ffff:0:0/96 */
+
+#define WL_BLOOM_INIT { NULL, 0, 0, 0, { 0 }, 0 }
+#define WL_BLOOM_BLOCK 512          /* bits of a block, one cache line */
+#define WL_BLOOM_MAX_K 16
+#define WL_BLOOM_MAX_LENS 8         /* prefix lengths worth probing before the trie */
+#define WL_BLOOM_TOO_MANY 1         /* the list holds more prefix lengths, not built */
+
+/* network / prefix as four host order words, most
+ * significant first. IPv4 is stored IPv4-mapped so
+ * both families share one trie and one lookup */
+struct wl_addr {
+    uint32_t               net[4];
+    int                      bits;
+};
+
+/* one node of the compressed (Patricia) prefix trie.
+ * nodes live in a single array and point to each other
+ * by index so a lookup walks contiguous memory */
+struct wl_trie_node {
+    uint32_t               net[4];
+    uint32_t             child[2];
+    uint8_t                  bits;
+    uint8_t                  term;
+    uint8_t                pad[6];
+};
+
+/* a trie either owns a growable node array or
+ * points into a read-only mapped index */
+struct wl_trie {
+    struct wl_trie_node*    nodes;
+    uint32_t                count;
+    uint32_t                  cap;
+    uint32_t                 root;
+    uint32_t              entries;
+    void*                     map;
+    size_t                 maplen;
+};
+
+/* on-disk index: this header followed by count nodes.
+ * integers are in the byte order of the compiling host,
+ * magic doubles as the byte order check */
+struct wl_index_header {
+    uint32_t                magic;
+    uint32_t              version;
+    uint32_t                count;
+    uint32_t                 root;
+    uint32_t              entries;
+    uint32_t             checksum;
+    uint32_t          reserved[2];
+};
+
+/* blocked Bloom filter over the networks of a trie,
+ * asked before it. a key sets all its bits in one
+ * block, so a miss reads one cache line for each
+ * prefix length the list holds. the blocks are a
+ * shared mapping, children of the process that
+ * built it read the same pages */
+struct wl_bloom {
+    uint64_t*              blocks;  /* WL_BLOOM_BLOCK / 64 words each */
+    uint32_t              nblocks;
+    int                         k;  /* bits set per key */
+    int                     nlens;
+    uint8_t    lens[WL_BLOOM_MAX_LENS];
+    size_t                  bytes;
+};
+
+struct wl_bot_list {
+    char*                    name;
+    int                   literal;
+    const void*              data;  /* the caller's, e.g. published ranges */
+    struct wl_bot_list*      next;
+};
+
+/* all WLBot patterns compiled into one matcher.
+ * literals go into an Aho-Corasick automaton over
+ * byte classes, everything else into a regex set */
+struct wl_matcher {
+    uint8_t              cls[256];
+    char               start[257];
+    int                    nstart;
+    int                  nclasses;
+    int                   nstates;
+    int32_t*                delta;
+    int32_t*                  out;
+    regex_t*                  rgx;
+    int32_t*                rgxid;
+    int                      nrgx;
+    const struct wl_bot_list** bots;  /* pattern id -> bot */
+};
+
+/* the hostname suffixes a bot's hosts live under, as
+ * a DFA over the reversed name: walking a PTR name from
+ * its last byte reaches an accepting state exactly where
+ * an allowed suffix starts */
+struct wl_domains {
+    uint8_t              cls[256];
+    int                  nclasses;
+    int                   nstates;
+    int32_t*                delta;  /* -1: no suffix continues */
+    uint8_t*               accept;
+};
+
+/* called for every list line that is not an address */
+typedef void (*wl_badline_fn)(void* baton, const char* path, unsigned long lineno, const char* line);
+
+int      wl_create_addr(const char* net, struct wl_addr* c_addr);
+int      wl_addr_same(const struct wl_addr* a, const struct wl_addr* b);
+int      wl_addr_is_v4(const struct wl_addr* a);
+int      wl_trie_insert(struct wl_trie* t, const struct wl_addr* a);
+int      wl_trie_lookup(const struct wl_trie* t, const uint32_t ip[4]);
+void     wl_trie_free(struct wl_trie* t);
+void     wl_trie_compact(struct wl_trie* t);
+size_t   wl_trie_bytes(const struct wl_trie* t);
+int      wl_trie_write(const struct wl_trie* t, const char* path);
+int      wl_trie_map(struct wl_trie* t, const char* path);
+int      wl_trie_read(struct wl_trie* t, const char* path, wl_badline_fn badline, void* baton, unsigned long* bad);
+int      wl_trie_read_ranges(struct wl_trie* t, const char* path, wl_badline_fn badline, void* baton, unsigned long* bad);
+
+int      wl_bloom_build(struct wl_bloom* b, const struct wl_trie* t, double rate);
+int      wl_bloom_maybe(const struct wl_bloom* b, const uint32_t ip[4]);
+void     wl_bloom_free(struct wl_bloom* b);
+
+int      wl_bot_is_literal(const char* bot);
+int      wl_matcher_build(const struct wl_bot_list* bots, struct wl_matcher** out, const char** badre);
+void     wl_matcher_free(struct wl_matcher* m);
+const struct wl_bot_list* wl_matcher_scan(const struct wl_matcher* m, const char* agent);
+const struct wl_bot_list* wl_matcher_regex(const struct wl_matcher* m, const char* agent);
+
+int      wl_domains_build(const char* const* suffixes, int n, struct wl_domains** out);
+void     wl_domains_free(struct wl_domains* d);
+int      wl_domains_match(const struct wl_domains* d, const char* name);
+
+#endif